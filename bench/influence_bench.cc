@@ -0,0 +1,312 @@
+// Microbenchmarks for the simulation kernels, the GEXF parser and whole
+// CELF runs, on synthetic graphs and on a fixed subsample of the npm data.
+// Build and run with ./benchmark.sh from the repository root.
+#define INFLUENCE_NO_MAIN
+#include "../src/weighted_max_influence.cc"
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <map>
+#include <sstream>
+#include <tuple>
+
+namespace {
+
+enum GraphKind { POWER_LAW, NPM_FAN_IN, NPM_SAMPLE };
+
+const char *kind_name(int kind) {
+  switch (kind) {
+  case POWER_LAW:
+    return "power-law";
+  case NPM_FAN_IN:
+    return "npm-fan-in";
+  default:
+    return "npm-sample";
+  }
+}
+
+// Preferential attachment: every new package is depended on by m older
+// ones picked by degree, so a few hubs fan out to large subtrees.
+Graph power_law_graph(int n, int m, std::mt19937_64 &rng) {
+  Graph g;
+  g.reserve(n, (size_t)n * m);
+  std::vector<int> endpoints;
+  for (int v = 0; v < n; ++v) {
+    g.get_internal_id("p" + std::to_string(v));
+    for (int j = 0; j < m && v > 0; ++j) {
+      int u = endpoints.empty()
+                  ? 0
+                  : endpoints[rng() % endpoints.size()];
+      g.pending_edges.push_back({u, v, 0.1f});
+      endpoints.push_back(u);
+      endpoints.push_back(v);
+    }
+    if (v == 0)
+      endpoints.push_back(0);
+  }
+  return g;
+}
+
+// npm-like fan-in: every package depends on a few others drawn from a
+// Zipf law over popularity, so most edges point at a handful of
+// ubiquitous utilities.
+Graph npm_fan_in_graph(int n, std::mt19937_64 &rng) {
+  Graph g;
+  g.reserve(n, (size_t)n * 4);
+  for (int v = 0; v < n; ++v)
+    g.get_internal_id("p" + std::to_string(v));
+  std::vector<double> cdf(n);
+  double total = 0.0;
+  for (int r = 0; r < n; ++r)
+    cdf[r] = total += 1.0 / (r + 1.0);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::geometric_distribution<int> deps(0.25);
+  for (int v = 0; v < n; ++v)
+    for (int j = deps(rng); j > 0; --j) {
+      int u = int(std::lower_bound(cdf.begin(), cdf.end(),
+                                   unit(rng) * total) -
+                  cdf.begin());
+      if (u != v)
+        g.pending_edges.push_back({v, u, 0.1f});
+    }
+  return g;
+}
+
+// a third of the packages carry a value, like the scored npm packages
+void assign_values(Graph &g, std::mt19937_64 &rng) {
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  for (int v = 0; v < g.num_nodes(); ++v)
+    if (rng() % 3 == 0)
+      g.set_node_value(v, unit(rng));
+}
+
+// keeps the kernels' progress chatter out of the benchmark table
+class Quiet {
+public:
+  Quiet() : out(std::cout.rdbuf(sink.rdbuf())), err(std::cerr.rdbuf(sink.rdbuf())) {}
+  ~Quiet() {
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+  }
+
+private:
+  std::ostringstream sink;
+  std::streambuf *out;
+  std::streambuf *err;
+};
+
+std::unique_ptr<Graph> build_graph(int kind, int n) {
+  Quiet quiet;
+  std::mt19937_64 rng(20240101 + kind);
+  std::unique_ptr<Graph> g;
+  if (kind == POWER_LAW) {
+    g = std::make_unique<Graph>(power_law_graph(n, 3, rng));
+  } else if (kind == NPM_FAN_IN) {
+    g = std::make_unique<Graph>(npm_fan_in_graph(n, rng));
+  } else {
+    // packages above 100k daily downloads, run from the repository root
+    try {
+      return std::make_unique<Graph>(CSVLoader::load(
+          "data/all_pkg_max_infl.csv", "data/flattened_dependencies.csv",
+          "inactivity_score", 100000, false));
+    } catch (const std::exception &) {
+      return nullptr;
+    }
+  }
+  assign_values(*g, rng);
+  g->finalize(true);
+  return g;
+}
+
+const Graph *graph(int kind, int n) {
+  static std::map<std::pair<int, int>, std::unique_ptr<Graph>> cache;
+  auto &slot = cache[{kind, n}];
+  if (!slot)
+    slot = build_graph(kind, n);
+  return slot.get();
+}
+
+const char *const ORDERS[] = {"original", "bfs", "rcm", "degree"};
+
+// the same graph renumbered by locality_order, built once per order
+const Graph *reordered(int kind, int n, int order) {
+  if (order == 0)
+    return graph(kind, n);
+  static std::map<std::tuple<int, int, int>, std::unique_ptr<Graph>> cache;
+  auto &slot = cache[{kind, n, order}];
+  if (!slot && (slot = build_graph(kind, n)))
+    slot->permute(locality_order(*slot, ORDERS[order]));
+  return slot.get();
+}
+
+// eligible sources with out-edges, in a fixed order
+std::vector<int> sources(const Graph &g, size_t count) {
+  std::vector<int> out;
+  for (int v = 0; v < g.num_nodes() && out.size() < count; ++v)
+    if (g.has_value[v] && g.out_degree(v) > 0)
+      out.push_back(v);
+  return out;
+}
+
+void report_rates(benchmark::State &state, const ThreadCounters &before) {
+  ThreadCounters after = Profiler::get().total();
+  state.counters["edges/s"] = benchmark::Counter(
+      double(after.edge_visits - before.edge_visits),
+      benchmark::Counter::kIsRate);
+  state.counters["cascades/s"] = benchmark::Counter(
+      double(after.cascades - before.cascades), benchmark::Counter::kIsRate);
+}
+
+const Graph *setup(benchmark::State &state) {
+  const Graph *g = graph((int)state.range(0), (int)state.range(1));
+  if (!g) {
+    state.SkipWithError("data/*.csv not found; run from the repo root");
+    return nullptr;
+  }
+  state.SetLabel(kind_name((int)state.range(0)));
+  return g;
+}
+
+void BM_SimulationToken(benchmark::State &state) {
+  const Graph *g = setup(state);
+  if (!g)
+    return;
+  std::vector<int> from = sources(*g, 256);
+  TokenScratch scratch(g->num_nodes());
+  std::vector<int> seed_list(1);
+  uint64_t world = 0;
+  ThreadCounters before = Profiler::get().total();
+  for (auto _ : state) {
+    seed_list[0] = from[world % from.size()];
+    benchmark::DoNotOptimize(run_weighted_simulation_token(
+        *g, seed_list, CounterRng::bits(7, world++), scratch));
+  }
+  report_rates(state, before);
+}
+
+void BM_EstimateSpread(benchmark::State &state) {
+  const Graph *g = setup(state);
+  if (!g)
+    return;
+  std::vector<int> from = sources(*g, 256);
+  BlockScratch scratch(g->num_nodes());
+  std::vector<int> seed_list(1);
+  size_t i = 0;
+  ThreadCounters before = Profiler::get().total();
+  for (auto _ : state) {
+    seed_list[0] = from[i++ % from.size()];
+    benchmark::DoNotOptimize(
+        estimate_weighted_spread(*g, seed_list, 256, 7, scratch));
+  }
+  report_rates(state, before);
+}
+
+// spreads of the same 256 packages in the original and the --reorder
+// layouts, so edges/s compares the layouts and nothing else
+void BM_Reorder(benchmark::State &state) {
+  const Graph *base = setup(state);
+  if (!base)
+    return;
+  const Graph *g = reordered((int)state.range(0), (int)state.range(1),
+                             (int)state.range(2));
+  state.SetLabel(std::string(kind_name((int)state.range(0))) + "/" +
+                 ORDERS[state.range(2)]);
+  std::vector<int> from;
+  for (int v : sources(*base, 256))
+    from.push_back(g->find_id(base->name(v)));
+  BlockScratch scratch(g->num_nodes());
+  std::vector<int> seed_list(1);
+  size_t i = 0;
+  ThreadCounters before = Profiler::get().total();
+  for (auto _ : state) {
+    seed_list[0] = from[i++ % from.size()];
+    benchmark::DoNotOptimize(
+        estimate_weighted_spread(*g, seed_list, 256, 7, scratch));
+  }
+  report_rates(state, before);
+}
+
+void BM_CELF(benchmark::State &state) {
+  const Graph *g = setup(state);
+  if (!g)
+    return;
+  ThreadCounters before = Profiler::get().total();
+  for (auto _ : state) {
+    Quiet quiet;
+    SeedReporter out(*g);
+    benchmark::DoNotOptimize(celf_weighted_influence(*g, 5, 128, 7, out));
+  }
+  report_rates(state, before);
+}
+
+// networkx-style GEXF of a power-law graph, written once
+const std::string &gexf_file(int n) {
+  static std::map<int, std::string> files;
+  std::string &path = files[n];
+  if (!path.empty())
+    return path;
+  path = (std::filesystem::temp_directory_path() /
+          ("influence_bench_" + std::to_string(n) + ".gexf"))
+             .string();
+  const Graph *g = graph(POWER_LAW, n);
+  std::ofstream out(path, std::ios::trunc);
+  out << "<?xml version='1.0' encoding='utf-8'?>\n"
+         "<gexf xmlns=\"http://www.gexf.net/1.2draft\" version=\"1.2\">\n"
+         "  <graph defaultedgetype=\"directed\" mode=\"static\" name=\"\">\n"
+         "    <attributes mode=\"static\" class=\"node\">\n"
+         "      <attribute id=\"0\" title=\"inactivity_score\" "
+         "type=\"double\" />\n"
+         "    </attributes>\n    <nodes>\n";
+  for (int v = 0; v < g->num_nodes(); ++v) {
+    out << "      <node id=\"" << g->name(v) << "\" label=\"" << g->name(v)
+        << "\">\n";
+    if (g->has_value[v])
+      out << "        <attvalues>\n          <attvalue for=\"0\" value=\""
+          << g->node_values[v] << "\" />\n        </attvalues>\n";
+    out << "      </node>\n";
+  }
+  out << "    </nodes>\n    <edges>\n";
+  for (int u = 0; u < g->num_nodes(); ++u)
+    for (uint32_t e = g->offsets[u]; e < g->offsets[u + 1]; ++e)
+      out << "      <edge source=\"" << g->name(u) << "\" target=\""
+          << g->name(g->targets[e]) << "\" id=\"" << e << "\" />\n";
+  out << "    </edges>\n  </graph>\n</gexf>\n";
+  return path;
+}
+
+void BM_GEXFParse(benchmark::State &state) {
+  const std::string &path = gexf_file((int)state.range(0));
+  size_t bytes = std::filesystem::file_size(path);
+  size_t edges = 0;
+  for (auto _ : state) {
+    Quiet quiet;
+    Graph g = GEXFParser::parse(path, "inactivity_score");
+    edges = g.num_edges();
+    benchmark::DoNotOptimize(g.offsets.data());
+  }
+  state.SetBytesProcessed(int64_t(state.iterations() * bytes));
+  state.counters["edges/s"] = benchmark::Counter(
+      double(state.iterations() * edges), benchmark::Counter::kIsRate);
+}
+
+void graphs(benchmark::internal::Benchmark *b) {
+  b->Args({POWER_LAW, 100000})->Args({NPM_FAN_IN, 100000});
+  b->Args({NPM_SAMPLE, 0});
+}
+
+void orders(benchmark::internal::Benchmark *b) {
+  for (int order = 0; order < 4; ++order)
+    b->Args({POWER_LAW, 100000, order})->Args({NPM_FAN_IN, 100000, order})
+        ->Args({NPM_SAMPLE, 0, order});
+}
+
+} // namespace
+
+BENCHMARK(BM_SimulationToken)->Apply(graphs);
+BENCHMARK(BM_EstimateSpread)->Apply(graphs)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Reorder)->Apply(orders)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CELF)->Apply(graphs)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GEXFParse)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
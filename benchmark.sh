@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+
+set -euo pipefail
+
+mkdir -p bin
+g++ -O3 -fopenmp bench/influence_bench.cc -o bin/influence_bench -lbenchmark -lpthread
+./bin/influence_bench "$@"
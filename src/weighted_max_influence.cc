@@ -1,402 +1,5289 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <mutex>
 #include <omp.h>
+#include <poll.h>
 #include <queue>
 #include <random>
-#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <vector>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 
-static int DEFAULT_MC_ROUNDS = 1000;
+[[maybe_unused]] static int DEFAULT_MC_ROUNDS = 1000;
 
 struct Edge {
+  int from;
   int to;
-  double probability;
+  float probability;
+};
+
+// Maps names to dense ids. Names are copied once into an append-only arena
+// and looked up through an open-addressing table (linear probing, load
+// factor <= 0.5) keyed on string_views, so lookups never allocate.
+class StringInterner {
+public:
+  static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+  int find(std::string_view s) const {
+    if (slots.empty())
+      return -1;
+    uint64_t h = hash(s);
+    size_t mask = slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+      int id = slots[i];
+      if (id < 0)
+        return -1;
+      if (hashes[id] == h && names[id] == s)
+        return id;
+    }
+  }
+
+  // returns the id of s, assigning the next free one if s is new
+  int intern(std::string_view s) {
+    if ((names.size() + 1) * 2 > slots.size())
+      rehash(std::max<size_t>(16, slots.size() * 2));
+    uint64_t h = hash(s);
+    size_t mask = slots.size() - 1;
+    size_t i = h & mask;
+    for (;; i = (i + 1) & mask) {
+      int id = slots[i];
+      if (id < 0)
+        break;
+      if (hashes[id] == h && names[id] == s)
+        return id;
+    }
+    int id = (int)names.size();
+    slots[i] = id;
+    names.push_back(store(s));
+    hashes.push_back(h);
+    return id;
+  }
+
+  void reserve(size_t n) {
+    names.reserve(n);
+    hashes.reserve(n);
+    size_t cap = 16;
+    while (cap < n * 2)
+      cap *= 2;
+    if (cap > slots.size())
+      rehash(cap);
+  }
+
+  std::string_view name(int id) const { return names[id]; }
+  size_t size() const { return names.size(); }
+
+private:
+  static uint64_t hash(std::string_view s) {
+    return std::hash<std::string_view>{}(s);
+  }
+
+  void rehash(size_t cap) {
+    slots.assign(cap, -1);
+    size_t mask = cap - 1;
+    for (size_t id = 0; id < names.size(); ++id) {
+      size_t i = hashes[id] & mask;
+      while (slots[i] >= 0)
+        i = (i + 1) & mask;
+      slots[i] = (int)id;
+    }
+  }
+
+  std::string_view store(std::string_view s) {
+    if (blocks.empty() || s.size() > block_cap - block_used) {
+      block_cap = std::max(BLOCK_SIZE, s.size());
+      blocks.emplace_back(new char[block_cap]);
+      block_used = 0;
+    }
+    char *dst = blocks.back().get() + block_used;
+    std::memcpy(dst, s.data(), s.size());
+    block_used += s.size();
+    return {dst, s.size()};
+  }
+
+  std::vector<int> slots;
+  std::vector<uint64_t> hashes;
+  std::vector<std::string_view> names;
+  std::vector<std::unique_ptr<char[]>> blocks;
+  size_t block_used = 0;
+  size_t block_cap = 0;
 };
 
 class Graph {
 public:
-  std::map<std::string, int> id_map;
-  std::vector<std::string> reverse_id_map;
-  std::vector<std::vector<Edge>> adj;
+  StringInterner id_map;
+  // CSR adjacency, filled by finalize(): out-edges of u are the ranges
+  // [offsets[u], offsets[u + 1]) of targets and probabilities
+  std::vector<uint32_t> offsets;
+  std::vector<int> targets;
+  std::vector<float> probabilities;
+  // probabilities pre-scaled to 2^-32 units: an edge is live when a uniform
+  // 32-bit draw is below its threshold
+  std::vector<uint32_t> thresholds;
   std::vector<double> node_values;
+  // node_values in fixed point (value * fixed_scale), used by the kernels
+  // so that sums are exact and independent of traversal order
+  std::vector<int64_t> fixed_values;
+  double fixed_scale = 1.0;
   std::vector<char> has_value;
+  // one column per attribute the loader was asked for; use_values() makes
+  // one of them the node_values/has_value the engines weight by
+  std::vector<std::string> value_names;
+  std::vector<std::vector<double>> value_columns;
+  std::vector<std::vector<char>> value_present;
+  // edges collected while loading, consumed by finalize()
+  std::vector<Edge> pending_edges;
 
-  int get_internal_id(const std::string &gexf_id) {
-    auto it = id_map.find(gexf_id);
-    if (it == id_map.end()) {
-      int new_id = reverse_id_map.size();
-      id_map[gexf_id] = new_id;
-      reverse_id_map.push_back(gexf_id);
-      adj.resize(new_id + 1);
-      node_values.resize(new_id + 1, 0.0);
-      has_value.resize(new_id + 1, 0);
-      return new_id;
+  int find_id(std::string_view name) const { return id_map.find(name); }
+
+  int get_internal_id(std::string_view gexf_id) {
+    int id = id_map.intern(gexf_id);
+    if (id == (int)node_values.size()) {
+      node_values.push_back(0.0);
+      has_value.push_back(0);
     }
-    return it->second;
+    return id;
+  }
+
+  // pre-sizes the name table and per-node arrays for a known graph size
+  void reserve(size_t nodes, size_t edges) {
+    id_map.reserve(nodes);
+    node_values.reserve(nodes);
+    has_value.reserve(nodes);
+    pending_edges.reserve(edges);
   }
 
-  void add_edge(const std::string &src, const std::string &target,
-                double prob) {
+  void add_edge(std::string_view src, std::string_view target, double prob) {
     int u = get_internal_id(src);
     int v = get_internal_id(target);
-    adj[u].push_back({v, prob});
+    pending_edges.push_back({u, v, (float)prob});
+  }
+
+  // stable counting sort of the pending edges into the CSR arrays;
+  // merge_parallel_edges keeps only the first u->v edge (DiGraph semantics)
+  void finalize(bool merge_parallel_edges = false) {
+    int n = num_nodes();
+    offsets.assign(n + 1, 0);
+    for (const auto &e : pending_edges)
+      offsets[e.from + 1]++;
+    for (int u = 0; u < n; ++u)
+      offsets[u + 1] += offsets[u];
+
+    targets.resize(pending_edges.size());
+    probabilities.resize(pending_edges.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (const auto &e : pending_edges) {
+      uint32_t slot = fill[e.from]++;
+      targets[slot] = e.to;
+      probabilities[slot] = e.probability;
+    }
+    std::vector<Edge>().swap(pending_edges);
+
+    if (merge_parallel_edges) {
+      std::vector<int> seen_from(n, -1);
+      uint32_t out = 0;
+      for (int u = 0; u < n; ++u) {
+        uint32_t begin = offsets[u], end = offsets[u + 1];
+        offsets[u] = out;
+        for (uint32_t e = begin; e < end; ++e) {
+          int v = targets[e];
+          if (seen_from[v] == u)
+            continue;
+          seen_from[v] = u;
+          targets[out] = v;
+          probabilities[out] = probabilities[e];
+          out++;
+        }
+      }
+      offsets[n] = out;
+      targets.resize(out);
+      probabilities.resize(out);
+    }
+    scale_thresholds();
+    scale_values();
+  }
+
+  // power-of-two scale leaving room to sum 64 worlds of every node in an
+  // int64_t
+  void scale_values() {
+    double max_abs = 0.0;
+    for (double v : node_values)
+      max_abs = std::max(max_abs, std::fabs(v));
+    fixed_scale = 1.0;
+    if (max_abs > 0.0)
+      fixed_scale = std::ldexp(
+          1.0, std::ilogb(std::ldexp(1.0, 62) /
+                          (max_abs * std::max(num_nodes(), 1) * 64.0)));
+    fixed_values.resize(node_values.size());
+    for (size_t v = 0; v < node_values.size(); ++v)
+      fixed_values[v] = std::llround(node_values[v] * fixed_scale);
+  }
+
+  double from_fixed(int64_t x) const { return x / fixed_scale; }
+
+  void scale_thresholds() {
+    thresholds.resize(probabilities.size());
+    for (size_t e = 0; e < probabilities.size(); ++e) {
+      double t = std::ceil((double)probabilities[e] * 4294967296.0);
+      thresholds[e] = (uint32_t)std::clamp(t, 0.0, 4294967295.0);
+    }
+  }
+
+  // removes every edge whose quantized threshold is below min_prob's, so
+  // cascades never spend a draw on them; returns the number removed
+  size_t drop_weak_edges(double min_prob) {
+    double cut = std::ceil(min_prob * 4294967296.0);
+    int n = num_nodes();
+    uint32_t out = 0;
+    for (int u = 0; u < n; ++u) {
+      uint32_t begin = offsets[u], end = offsets[u + 1];
+      offsets[u] = out;
+      for (uint32_t e = begin; e < end; ++e) {
+        if ((double)thresholds[e] < cut)
+          continue;
+        targets[out] = targets[e];
+        probabilities[out] = probabilities[e];
+        thresholds[out] = thresholds[e];
+        out++;
+      }
+    }
+    size_t dropped = targets.size() - out;
+    offsets[n] = out;
+    targets.resize(out);
+    probabilities.resize(out);
+    thresholds.resize(out);
+    return dropped;
+  }
+
+  // renumbers the nodes so that order[i] becomes node i; names, values,
+  // value columns and every node's out-edges (in their old order) move
+  // with them
+  void permute(const std::vector<int> &order) {
+    size_t n = num_nodes();
+    std::vector<int> rank(n);
+    for (size_t i = 0; i < n; ++i)
+      rank[order[i]] = (int)i;
+
+    StringInterner ids;
+    ids.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+      ids.intern(id_map.name(order[i]));
+    id_map = std::move(ids);
+
+    std::vector<uint32_t> new_offsets(n + 1, 0);
+    std::vector<int> new_targets(targets.size());
+    std::vector<float> new_probabilities(probabilities.size());
+    std::vector<uint32_t> new_thresholds(thresholds.size());
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t out = new_offsets[i];
+      for (uint32_t e = offsets[order[i]]; e < offsets[order[i] + 1]; ++e) {
+        new_targets[out] = rank[targets[e]];
+        new_probabilities[out] = probabilities[e];
+        new_thresholds[out] = thresholds[e];
+        out++;
+      }
+      new_offsets[i + 1] = out;
+    }
+    offsets.swap(new_offsets);
+    targets.swap(new_targets);
+    probabilities.swap(new_probabilities);
+    thresholds.swap(new_thresholds);
+
+    auto apply = [&](auto &values) {
+      values.resize(n);
+      std::remove_reference_t<decltype(values)> moved(n);
+      for (size_t i = 0; i < n; ++i)
+        moved[i] = values[order[i]];
+      values.swap(moved);
+    };
+    apply(node_values);
+    apply(fixed_values);
+    apply(has_value);
+    for (auto &column : value_columns)
+      apply(column);
+    for (auto &present : value_present)
+      apply(present);
   }
 
-  void set_node_value(const std::string &gexf_id, double val) {
-    int u = get_internal_id(gexf_id);
+  void set_node_value(int u, double val) {
     node_values[u] = val;
     has_value[u] = 1;
   }
 
-  int num_nodes() const { return (int)reverse_id_map.size(); }
+  void add_value_columns(const std::vector<std::string> &names) {
+    value_names = names;
+    value_columns.assign(names.size(), {});
+    value_present.assign(names.size(), {});
+  }
+
+  void set_column_value(size_t column, int u, double val) {
+    if (value_columns[column].size() <= (size_t)u) {
+      value_columns[column].resize(u + 1, 0.0);
+      value_present[column].resize(u + 1, 0);
+    }
+    value_columns[column][u] = val;
+    value_present[column][u] = 1;
+  }
+
+  int value_column(std::string_view name) const {
+    auto it = std::find(value_names.begin(), value_names.end(), name);
+    return it == value_names.end() ? -1 : int(it - value_names.begin());
+  }
+
+  void use_values(size_t column) {
+    size_t n = num_nodes();
+    value_columns[column].resize(n, 0.0);
+    value_present[column].resize(n, 0);
+    node_values = value_columns[column];
+    has_value = value_present[column];
+    scale_values();
+  }
+
+  void set_node_value(std::string_view gexf_id, double val) {
+    set_node_value(get_internal_id(gexf_id), val);
+  }
+
+  int num_nodes() const { return (int)id_map.size(); }
+  std::string_view name(int u) const { return id_map.name(u); }
+  size_t num_edges() const { return targets.size(); }
+  int out_degree(int u) const { return offsets[u + 1] - offsets[u]; }
+};
+
+// Node orders for Graph::permute that put nodes that are close in the
+// graph close in memory, so a cascade touches fewer cache lines. All of
+// them look at the graph as undirected: "bfs" visits it from the busiest
+// node of each component, "rcm" is reverse Cuthill-McKee (BFS from a
+// low-degree node, neighbours by increasing degree, reversed) and
+// "degree" puts the hubs first. Ties go to the lower current id, so the
+// order is deterministic.
+std::vector<int> locality_order(const Graph &g, const std::string &method) {
+  int n = g.num_nodes();
+  std::vector<uint32_t> adj_offsets(n + 1, 0);
+  for (int u = 0; u < n; ++u)
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+      adj_offsets[u + 1]++;
+      adj_offsets[g.targets[e] + 1]++;
+    }
+  for (int u = 0; u < n; ++u)
+    adj_offsets[u + 1] += adj_offsets[u];
+  std::vector<int> adj(adj_offsets[n]);
+  std::vector<uint32_t> fill(adj_offsets.begin(), adj_offsets.end() - 1);
+  for (int u = 0; u < n; ++u)
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+      adj[fill[u]++] = g.targets[e];
+      adj[fill[g.targets[e]]++] = u;
+    }
+  auto degree = [&](int u) { return adj_offsets[u + 1] - adj_offsets[u]; };
+
+  std::vector<int> order(n);
+  for (int u = 0; u < n; ++u)
+    order[u] = u;
+  if (method == "degree") {
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return degree(a) > degree(b); });
+    return order;
+  }
+
+  bool rcm = method == "rcm";
+  std::vector<int> starts = order;
+  std::stable_sort(starts.begin(), starts.end(), [&](int a, int b) {
+    return rcm ? degree(a) < degree(b) : degree(a) > degree(b);
+  });
+  std::vector<char> seen(n, 0);
+  std::vector<int> neighbours;
+  order.clear();
+  for (int start : starts) {
+    if (seen[start])
+      continue;
+    seen[start] = 1;
+    order.push_back(start);
+    for (size_t head = order.size() - 1; head < order.size(); ++head) {
+      int u = order[head];
+      neighbours.clear();
+      for (uint32_t a = adj_offsets[u]; a < adj_offsets[u + 1]; ++a)
+        if (!seen[adj[a]]) {
+          seen[adj[a]] = 1;
+          neighbours.push_back(adj[a]);
+        }
+      if (rcm)
+        std::stable_sort(
+            neighbours.begin(), neighbours.end(),
+            [&](int a, int b) { return degree(a) < degree(b); });
+      order.insert(order.end(), neighbours.begin(), neighbours.end());
+    }
+  }
+  if (rcm)
+    std::reverse(order.begin(), order.end());
+  return order;
+}
+
+// average |u - v| over the edges u -> v, a rough measure of how scattered
+// a cascade's accesses are
+double mean_edge_span(const Graph &g) {
+  double total = 0.0;
+  for (int u = 0; u < g.num_nodes(); ++u)
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+      total += std::abs(g.targets[e] - u);
+  return g.num_edges() ? total / g.num_edges() : 0.0;
+}
+
+// read-only mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Cannot open file " + filename + ": " +
+                               std::strerror(errno));
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot stat file " + filename);
+    }
+    size = (size_t)st.st_size;
+    if (size > 0) {
+      void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Cannot mmap file " + filename);
+      }
+      ::madvise(p, size, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(p);
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data)
+      ::munmap(const_cast<char *>(data), size);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::string_view view() const { return {data, size}; }
+
+  const char *data = nullptr;
+  size_t size = 0;
 };
 
-// please dont judge
+static bool parse_double(std::string_view s, double &out) {
+  auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+  return res.ec == std::errc() && !s.empty();
+}
+
+// single pass over the mapped file, tokens are views into the mapping
 class GEXFParser {
 public:
   static Graph parse(const std::string &filename,
                      const std::string &target_attr_name) {
+    return parse(filename, std::vector<std::string>{target_attr_name});
+  }
+
+  // every attribute in attr_names becomes a value column, in that order;
+  // the first one is selected
+  static Graph parse(const std::string &filename,
+                     const std::vector<std::string> &attr_names) {
+    auto start = std::chrono::steady_clock::now();
     Graph g;
-    std::ifstream file(filename);
-    if (!file.is_open())
-      throw std::runtime_error("Cannot open file");
-
-    std::ostringstream ss;
-    ss << file.rdbuf();
-    std::string content = ss.str();
-
-    auto get_xml_attr = [&](const std::string &tag,
-                            const std::string &attr) -> std::string {
-      std::string needle = attr + "=\"";
-      size_t start = tag.find(needle);
-      if (start == std::string::npos)
-        return "";
-      start += needle.length();
-      size_t end = tag.find('"', start);
-      if (end == std::string::npos)
-        return "";
-      return tag.substr(start, end - start);
-    };
+    g.add_value_columns(attr_names);
+    MappedFile file(filename);
+    std::string_view content = file.view();
+
+    std::vector<std::string_view> attr_ids(attr_names.size());
+    size_t attrs_found = 0;
+    int current_node = -1;
 
-    std::string target_attr_id;
     size_t pos = 0;
-    while (true) {
-      size_t attr_pos = content.find("<attribute", pos);
-      if (attr_pos == std::string::npos)
-        break;
-      size_t end_pos = content.find('>', attr_pos);
-      if (end_pos == std::string::npos)
-        break;
-      std::string tag = content.substr(attr_pos, end_pos - attr_pos + 1);
-      std::string title = get_xml_attr(tag, "title");
-      if (title == target_attr_name) {
-        target_attr_id = get_xml_attr(tag, "id");
-        std::cerr << "Found Attribute ID for '" << title
-                  << "': " << target_attr_id << std::endl;
+    while ((pos = content.find('<', pos)) != std::string_view::npos) {
+      if (content.compare(pos + 1, 3, "!--") == 0) {
+        size_t comment_end = content.find("-->", pos + 4);
+        if (comment_end == std::string_view::npos)
+          break;
+        pos = comment_end + 3;
+        continue;
+      }
+      size_t tag_end = content.find('>', pos);
+      if (tag_end == std::string_view::npos)
         break;
+      std::string_view tag = content.substr(pos + 1, tag_end - pos - 1);
+      pos = tag_end + 1;
+
+      bool self_closing = !tag.empty() && tag.back() == '/';
+      std::string_view name = tag_name(tag);
+
+      if (name == "attvalue") {
+        if (current_node < 0 || attrs_found == 0)
+          continue;
+        std::string_view id = xml_attr(tag, "for");
+        size_t c = std::find(attr_ids.begin(), attr_ids.end(), id) -
+                   attr_ids.begin();
+        double val;
+        if (c < attr_ids.size() && !id.empty() &&
+            parse_double(xml_attr(tag, "value"), val))
+          g.set_column_value(c, current_node, val);
+      } else if (name == "edge") {
+        std::string_view s = xml_attr(tag, "source");
+        std::string_view t = xml_attr(tag, "target");
+        double prob = 0.1;
+        parse_double(xml_attr(tag, "weight"), prob);
+        if (!s.empty() && !t.empty())
+          g.add_edge(s, t, prob);
+      } else if (name == "node") {
+        std::string_view node_id = xml_attr(tag, "id");
+        current_node = -1;
+        if (!node_id.empty()) {
+          int u = g.get_internal_id(node_id);
+          if (!self_closing)
+            current_node = u;
+        }
+      } else if (name == "nodes" || name == "edges") {
+        double count;
+        if (parse_double(xml_attr(tag, "count"), count) && count > 0)
+          name == "nodes" ? g.reserve((size_t)count, 0)
+                          : g.pending_edges.reserve((size_t)count);
+      } else if (name == "/node") {
+        current_node = -1;
+      } else if (name == "attribute" && attrs_found < attr_names.size()) {
+        std::string_view title = xml_attr(tag, "title");
+        for (size_t c = 0; c < attr_names.size(); ++c) {
+          if (!attr_ids[c].empty() || title != attr_names[c])
+            continue;
+          attr_ids[c] = xml_attr(tag, "id");
+          attrs_found += !attr_ids[c].empty();
+          std::cerr << "Found Attribute ID for '" << attr_names[c]
+                    << "': " << attr_ids[c] << std::endl;
+        }
       }
-      pos = end_pos + 1;
     }
 
-    if (target_attr_id.empty()) {
-      std::cerr << "Warning: Attribute '" << target_attr_name
-                << "' not found in GEXF definitions." << std::endl;
+    for (size_t c = 0; c < attr_names.size(); ++c)
+      if (attr_ids[c].empty())
+        std::cerr << "Warning: Attribute '" << attr_names[c]
+                  << "' not found in GEXF definitions." << std::endl;
+    g.finalize();
+    g.use_values(0);
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    double mb = file.size / (1024.0 * 1024.0);
+    std::cerr << "Parsed " << mb << " MB in " << elapsed.count() << "s ("
+              << mb / std::max(elapsed.count(), 1e-9) << " MB/s)"
+              << std::endl;
+    return g;
+  }
+
+private:
+  static std::string_view tag_name(std::string_view tag) {
+    size_t end = tag.find_first_of(" \t\r\n/>", tag.empty() ? 0 : 1);
+    return tag.substr(0, end);
+  }
+
+  // value of attr="..." inside a tag, empty if missing
+  static std::string_view xml_attr(std::string_view tag,
+                                   std::string_view attr) {
+    size_t p = 0;
+    while ((p = tag.find(attr, p)) != std::string_view::npos) {
+      size_t after = p + attr.size();
+      bool at_boundary = p > 0 && (tag[p - 1] == ' ' || tag[p - 1] == '\t' ||
+                                   tag[p - 1] == '\n' || tag[p - 1] == '\r');
+      if (at_boundary && tag.compare(after, 2, "=\"") == 0) {
+        size_t start = after + 2;
+        size_t end = tag.find('"', start);
+        if (end == std::string_view::npos)
+          return {};
+        return tag.substr(start, end - start);
+      }
+      p = after;
     }
+    return {};
+  }
+};
 
-    pos = 0;
-    while (true) {
-      size_t node_pos = content.find("<node", pos);
-      if (node_pos == std::string::npos)
-        break;
-      size_t node_tag_end = content.find('>', node_pos);
-      if (node_tag_end == std::string::npos)
-        break;
-      bool self_closing = false;
-      if (content[node_tag_end - 1] == '/')
-        self_closing = true;
-
-      size_t node_block_end = node_tag_end;
-      if (!self_closing) {
-        size_t close_pos = content.find("</node>", node_tag_end + 1);
-        if (close_pos == std::string::npos)
-          break;
-        node_block_end = close_pos + 7;
-      }
-
-      std::string node_block =
-          content.substr(node_pos, node_block_end - node_pos);
-      std::string node_id =
-          get_xml_attr(node_block.substr(0, node_tag_end - node_pos + 1), "id");
-      if (!node_id.empty()) {
-        int u = g.get_internal_id(node_id);
-        size_t p = 0;
-        while (true) {
-          size_t av = node_block.find("<attvalue", p);
-          if (av == std::string::npos)
-            break;
-          size_t av_end = node_block.find('>', av);
-          if (av_end == std::string::npos)
-            break;
-          std::string av_tag = node_block.substr(av, av_end - av + 1);
-          std::string for_id = get_xml_attr(av_tag, "for");
-          if (!target_attr_id.empty() && for_id == target_attr_id) {
-            std::string val_str = get_xml_attr(av_tag, "value");
-            if (!val_str.empty()) {
-              try {
-                double val = std::stod(val_str);
-                g.set_node_value(node_id, val);
-              } catch (...) {
-              }
-            }
-          }
-          p = av_end + 1;
+// splits the CSV record starting at pos into fields, reading quotes the way
+// python's csv module does ("" inside a quoted field is a literal quote).
+// Fields that need unescaping are materialized in storage, all others are
+// views into data. Returns the position of the next record.
+static size_t split_csv_record(std::string_view data, size_t pos,
+                               std::vector<std::string_view> &fields,
+                               std::deque<std::string> &storage) {
+  fields.clear();
+  size_t n = data.size();
+  auto strip_cr = [&](std::string_view f, size_t end) {
+    if (!f.empty() && f.back() == '\r' && (end == n || data[end] == '\n'))
+      f.remove_suffix(1);
+    return f;
+  };
+  while (true) {
+    size_t end;
+    if (pos < n && data[pos] == '"') {
+      bool escaped = false;
+      size_t close = pos + 1;
+      while ((close = data.find('"', close)) != std::string_view::npos &&
+             close + 1 < n && data[close + 1] == '"') {
+        escaped = true;
+        close += 2;
+      }
+      if (close == std::string_view::npos)
+        close = n;
+      end = std::min(data.find_first_of(",\n", std::min(close + 1, n)), n);
+      std::string_view inner = data.substr(pos + 1, close - pos - 1);
+      std::string_view tail;
+      if (close < n)
+        tail = strip_cr(data.substr(close + 1, end - close - 1), end);
+      if (!escaped && tail.empty()) {
+        fields.push_back(inner);
+      } else {
+        std::string &buf = storage.emplace_back();
+        for (size_t i = 0; i < inner.size(); ++i) {
+          buf.push_back(inner[i]);
+          if (inner[i] == '"')
+            ++i;
         }
+        buf.append(tail);
+        fields.push_back(buf);
       }
+    } else {
+      end = std::min(data.find_first_of(",\n", pos), n);
+      fields.push_back(strip_cr(data.substr(pos, end - pos), end));
+    }
+    if (end >= n)
+      return n;
+    if (data[end] == '\n')
+      return end + 1;
+    pos = end + 1;
+  }
+}
+
+// Per-edge activation probability for the CSV loader. The default is the
+// constant 0.1 that the GEXF path uses for edges without a weight; the
+// logistic model is
+//   p = 1 / (1 + exp(-(bias + inactivity * I + maintainers * ln(1 + M) +
+//                      downloads * log10(1 + D))))
+// with I the inactivity_score of the dependency (target_pkg) and M, D the
+// maintainer_count and avg_daily columns of the edge row (the dependent).
+struct EdgeModel {
+  bool logistic = false;
+  double constant = 0.1;
+  double bias = -3.0;
+  double inactivity = 2.5;
+  double maintainers = -0.5;
+  double downloads = 0.1;
+
+  // "<p>", "logistic" or "logistic:bias=..,inactivity=..,maintainers=..,
+  // downloads=.." with any subset of the coefficients
+  static bool parse(const std::string &spec, EdgeModel &m) {
+    m = EdgeModel();
+    if (spec.rfind("logistic", 0) != 0) {
+      char *end = nullptr;
+      m.constant = std::strtod(spec.c_str(), &end);
+      return end != spec.c_str() && *end == '\0' && m.constant >= 0.0 &&
+             m.constant <= 1.0;
+    }
+    m.logistic = true;
+    if (spec.size() == 8)
+      return true;
+    if (spec[8] != ':')
+      return false;
+    size_t begin = 9;
+    while (begin < spec.size()) {
+      size_t end = std::min(spec.find(',', begin), spec.size());
+      std::string term = spec.substr(begin, end - begin);
+      size_t eq = term.find('=');
+      double value = 0.0;
+      if (eq == std::string::npos ||
+          !parse_double(std::string_view(term).substr(eq + 1), value))
+        return false;
+      std::string key = term.substr(0, eq);
+      if (key == "bias")
+        m.bias = value;
+      else if (key == "inactivity")
+        m.inactivity = value;
+      else if (key == "maintainers")
+        m.maintainers = value;
+      else if (key == "downloads")
+        m.downloads = value;
+      else
+        return false;
+      begin = end + 1;
+    }
+    return true;
+  }
 
-      pos = node_block_end;
+  // one branch-free pass over the feature columns
+  void apply(const float *inact, const float *maint, const float *daily,
+             float *out, size_t n) const {
+    if (!logistic) {
+      std::fill(out, out + n, (float)constant);
+      return;
+    }
+    float b = (float)bias, wi = (float)inactivity, wm = (float)maintainers,
+          wd = (float)downloads;
+#pragma omp parallel for simd schedule(static)
+    for (size_t e = 0; e < n; ++e) {
+      float z = b + wi * inact[e] + wm * std::log1p(maint[e]) +
+                wd * std::log10(1.0f + daily[e]);
+      out[e] = 1.0f / (1.0f + std::exp(-z));
     }
+  }
+};
 
-    pos = 0;
-    while (true) {
-      size_t edge_pos = content.find("<edge", pos);
-      if (edge_pos == std::string::npos)
-        break;
-      size_t edge_end = content.find('>', edge_pos);
-      if (edge_end == std::string::npos)
-        break;
-      std::string tag = content.substr(edge_pos, edge_end - edge_pos + 1);
-      std::string s = get_xml_attr(tag, "source");
-      std::string t = get_xml_attr(tag, "target");
-      std::string w_str = get_xml_attr(tag, "weight");
-
-      double prob = 0.1;
-      if (!w_str.empty()) {
-        try {
-          prob = std::stod(w_str);
-        } catch (...) {
+// Reads the node and edge CSVs directly, with the same filtering as
+// add_nodes_to_graph/add_edges_to_graph in build-dependency-graph.py.
+// Both files are split into record-aligned chunks that are parsed in
+// parallel; ids are still assigned in file order.
+class CSVLoader {
+public:
+  static Graph load(const std::string &nodes_path,
+                    const std::string &edges_path,
+                    const std::string &target_attr_name,
+                    long long min_avg_daily, bool reverse,
+                    const EdgeModel &model = EdgeModel()) {
+    return load(nodes_path, edges_path,
+                std::vector<std::string>{target_attr_name}, min_avg_daily,
+                reverse, model);
+  }
+
+  // one value column per name in attr_names, the first one selected
+  static Graph load(const std::string &nodes_path,
+                    const std::string &edges_path,
+                    const std::vector<std::string> &attr_names,
+                    long long min_avg_daily, bool reverse,
+                    const EdgeModel &model = EdgeModel()) {
+    auto start = std::chrono::steady_clock::now();
+    Graph g;
+    g.add_value_columns(attr_names);
+
+    MappedFile nodes_file(nodes_path);
+    Table nodes = split_table(nodes_file.view());
+    int name_col = nodes.column("pkg_name");
+    int avg_col = nodes.column("avg_daily");
+    std::vector<int> value_cols;
+    for (const auto &attr : attr_names)
+      value_cols.push_back(nodes.column(attr));
+    size_t columns = value_cols.size();
+    int inactivity_col = nodes.column("inactivity_score");
+    if (name_col < 0)
+      throw std::runtime_error(nodes_path + " has no pkg_name column");
+    for (size_t c = 0; c < columns; ++c)
+      if (value_cols[c] < 0)
+        std::cerr << "Warning: Attribute '" << attr_names[c]
+                  << "' not found in " << nodes_path << " header."
+                  << std::endl;
+    if (model.logistic && inactivity_col < 0)
+      std::cerr << "Warning: no inactivity_score column in " << nodes_path
+                << ", the edge model treats it as 0." << std::endl;
+
+    // values of row i are values[i * columns + c], NaN when missing
+    struct NodeRows {
+      std::vector<std::string_view> names;
+      std::vector<float> inactivity;
+      std::vector<double> values;
+    };
+    int chunks = (int)nodes.chunks.size();
+    std::vector<NodeRows> node_rows(chunks);
+    std::vector<std::deque<std::string>> node_storage(chunks);
+
+#pragma omp parallel
+    {
+      std::vector<std::string_view> fields;
+#pragma omp for schedule(dynamic)
+      for (int c = 0; c < chunks; ++c) {
+        size_t pos = nodes.chunks[c].first, end = nodes.chunks[c].second;
+        while (pos < end) {
+          pos = split_csv_record(nodes.data, pos, fields, node_storage[c]);
+          std::string_view name = field(fields, name_col);
+          if (name.empty())
+            continue;
+          double avg_daily = 0.0;
+          if (!parse_double(field(fields, avg_col), avg_daily))
+            avg_daily = 0.0;
+          if ((long long)avg_daily < min_avg_daily)
+            continue;
+          NodeRows &rows = node_rows[c];
+          rows.names.push_back(name);
+          for (int col : value_cols) {
+            double value;
+            if (!parse_double(field(fields, col), value))
+              value = std::nan("");
+            rows.values.push_back(value);
+          }
+          double inactivity = 0.0;
+          if (!parse_double(field(fields, inactivity_col), inactivity))
+            inactivity = 0.0;
+          rows.inactivity.push_back((float)inactivity);
+        }
+      }
+    }
+
+    size_t total_rows = 0;
+    for (const auto &rows : node_rows)
+      total_rows += rows.names.size();
+    g.reserve(total_rows, 0);
+    std::vector<float> node_inactivity;
+    node_inactivity.reserve(total_rows);
+    for (const auto &rows : node_rows)
+      for (size_t i = 0; i < rows.names.size(); ++i) {
+        int u = g.get_internal_id(rows.names[i]);
+        for (size_t c = 0; c < columns; ++c) {
+          double value = rows.values[i * columns + c];
+          if (!std::isnan(value))
+            g.set_column_value(c, u, value);
         }
+        if (u == (int)node_inactivity.size())
+          node_inactivity.push_back(rows.inactivity[i]);
       }
 
-      if (!s.empty() && !t.empty()) {
-        g.add_edge(s, t, prob);
+    MappedFile edges_file(edges_path);
+    Table edges = split_table(edges_file.view());
+    int source_col = edges.column("source_pkg");
+    int target_col = edges.column("target_pkg");
+    if (source_col < 0 || target_col < 0)
+      throw std::runtime_error(edges_path +
+                               " needs source_pkg and target_pkg columns");
+    int maint_col = edges.column("maintainer_count");
+    int daily_col = edges.column("avg_daily");
+    if (model.logistic && (maint_col < 0 || daily_col < 0))
+      std::cerr << "Warning: " << edges_path
+                << " lacks maintainer_count or avg_daily, the edge model"
+                   " treats them as 0."
+                << std::endl;
+
+    // features stay in columns so the model runs as one flat pass
+    struct EdgeRows {
+      std::vector<Edge> edges;
+      std::vector<float> inactivity, maintainers, daily;
+    };
+    chunks = (int)edges.chunks.size();
+    std::vector<EdgeRows> edge_rows(chunks);
+#pragma omp parallel
+    {
+      std::vector<std::string_view> fields;
+      std::deque<std::string> storage;
+#pragma omp for schedule(dynamic)
+      for (int c = 0; c < chunks; ++c) {
+        size_t pos = edges.chunks[c].first, end = edges.chunks[c].second;
+        while (pos < end) {
+          pos = split_csv_record(edges.data, pos, fields, storage);
+          int u = g.find_id(field(fields, source_col));
+          int v = g.find_id(field(fields, target_col));
+          if (u < 0 || v < 0) {
+            storage.clear();
+            continue;
+          }
+          EdgeRows &rows = edge_rows[c];
+          if (model.logistic) {
+            double maint = 0.0, daily = 0.0;
+            parse_double(field(fields, maint_col), maint);
+            parse_double(field(fields, daily_col), daily);
+            rows.inactivity.push_back(node_inactivity[v]);
+            rows.maintainers.push_back((float)std::max(maint, 0.0));
+            rows.daily.push_back((float)std::max(daily, 0.0));
+          }
+          if (reverse)
+            std::swap(u, v);
+          rows.edges.push_back({u, v, 0.0f});
+          // unescaped fields live here until the features are parsed
+          storage.clear();
+        }
       }
-      pos = edge_end + 1;
     }
 
+    size_t total_edges = 0;
+    for (const auto &rows : edge_rows)
+      total_edges += rows.edges.size();
+    g.pending_edges.reserve(total_edges);
+    std::vector<float> inactivity, maintainers, daily, prob(total_edges);
+    if (model.logistic) {
+      inactivity.reserve(total_edges);
+      maintainers.reserve(total_edges);
+      daily.reserve(total_edges);
+    }
+    for (auto &rows : edge_rows) {
+      g.pending_edges.insert(g.pending_edges.end(), rows.edges.begin(),
+                             rows.edges.end());
+      inactivity.insert(inactivity.end(), rows.inactivity.begin(),
+                        rows.inactivity.end());
+      maintainers.insert(maintainers.end(), rows.maintainers.begin(),
+                         rows.maintainers.end());
+      daily.insert(daily.end(), rows.daily.begin(), rows.daily.end());
+      std::vector<Edge>().swap(rows.edges);
+    }
+    model.apply(inactivity.data(), maintainers.data(), daily.data(),
+                prob.data(), total_edges);
+    for (size_t e = 0; e < total_edges; ++e)
+      g.pending_edges[e].probability = prob[e];
+    g.finalize(true);
+    g.use_values(0);
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    double mb = (nodes_file.size + edges_file.size) / (1024.0 * 1024.0);
+    std::cerr << "Loaded " << g.num_nodes() << " nodes and " << g.num_edges()
+              << " edges from " << mb << " MB of CSV in " << elapsed.count()
+              << "s (" << mb / std::max(elapsed.count(), 1e-9) << " MB/s)"
+              << std::endl;
     return g;
   }
-};
 
-double run_weighted_simulation_token(const Graph &g,
-                                     const std::vector<int> &seed_list,
-                                     std::mt19937 &rng,
-                                     std::vector<unsigned int> &last_seen,
-                                     int seen_token) {
-  int n = g.num_nodes();
-  std::deque<int> q;
-  double total_value = 0.0;
+private:
+  struct Table {
+    std::string_view data;
+    std::vector<std::string> header;
+    std::vector<std::pair<size_t, size_t>> chunks;
 
-  for (int s : seed_list) {
-    if (last_seen[s] != seen_token) {
-      last_seen[s] = seen_token;
-      q.push_back(s);
-      total_value += g.node_values[s];
+    int column(const std::string &name) const {
+      auto it = std::find(header.begin(), header.end(), name);
+      return it == header.end() ? -1 : int(it - header.begin());
     }
+  };
+
+  static std::string_view field(const std::vector<std::string_view> &fields,
+                                int col) {
+    return col >= 0 && col < (int)fields.size() ? fields[col]
+                                                : std::string_view();
   }
 
-  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  // reads the header and cuts the body at newlines outside of quotes
+  static Table split_table(std::string_view data) {
+    Table t;
+    t.data = data;
+    std::vector<std::string_view> fields;
+    std::deque<std::string> storage;
+    size_t body = split_csv_record(data, 0, fields, storage);
+    t.header.assign(fields.begin(), fields.end());
+
+    std::vector<size_t> quotes;
+    for (size_t q = data.find('"', body); q != std::string_view::npos;
+         q = data.find('"', q + 1))
+      quotes.push_back(q);
+    auto inside_quotes = [&](size_t p) {
+      return (std::lower_bound(quotes.begin(), quotes.end(), p) -
+              quotes.begin()) %
+                 2 ==
+             1;
+    };
 
-  while (!q.empty()) {
-    int u = q.front();
-    q.pop_front();
-    for (const auto &edge : g.adj[u]) {
-      int v = edge.to;
-      if (last_seen[v] != seen_token) {
-        double r = dist(rng);
-        if (r <= edge.probability) {
-          last_seen[v] = seen_token;
-          total_value += g.node_values[v];
-          q.push_back(v);
+    size_t target_chunks = (size_t)omp_get_max_threads() * 8;
+    size_t step = std::max<size_t>((data.size() - body) / target_chunks, 1);
+    size_t begin = body;
+    while (begin < data.size()) {
+      size_t cut = std::min(begin + step, data.size());
+      while (cut < data.size()) {
+        cut = data.find('\n', cut);
+        if (cut == std::string_view::npos) {
+          cut = data.size();
+          break;
         }
+        if (!inside_quotes(cut)) {
+          cut++;
+          break;
+        }
+        cut++;
       }
+      t.chunks.emplace_back(begin, cut);
+      begin = cut;
     }
+    return t;
   }
-  return total_value;
-}
+};
 
-double estimate_weighted_spread(const Graph &g,
-                                const std::vector<int> &seed_list,
-                                int mc_rounds, std::mt19937 &rng) {
-  double total_spread = 0.0;
-  int n = g.num_nodes();
-  std::vector<unsigned int> last_seen(n, 0u);
-  unsigned int token = 1u;
+// .wmig: versioned binary dump of a parsed Graph in CSR layout.
+// header | attr name | offsets | targets | probabilities | node_values |
+// has_value | name offsets | name bytes, every section 8-byte aligned.
+class GraphSnapshot {
+public:
+  static constexpr char MAGIC[4] = {'W', 'M', 'I', 'G'};
+  // version 3 stores one value column per attribute; a version 2 file is
+  // the same layout with exactly one
+  static constexpr uint32_t VERSION = 3;
+  static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304u;
 
-  for (int i = 0; i < mc_rounds; ++i) {
-    if (++token == 0u) {
-      token = 1;
-      std::fill(last_seen.begin(), last_seen.end(), 0u);
-    }
-    total_spread +=
-        run_weighted_simulation_token(g, seed_list, rng, last_seen, token);
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t attr_name_len;
+    uint64_t num_nodes;
+    uint64_t num_edges;
+    uint64_t names_bytes;
+  };
+
+  // writes every value column of g; the attribute names are stored
+  // newline-separated where version 2 kept the single name
+  static void write(const Graph &g, const std::string &filename) {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+      throw std::runtime_error("Cannot open file " + filename);
+    write(g, out);
+    if (!out)
+      throw std::runtime_error("Failed writing snapshot " + filename);
+    std::cerr << "Wrote snapshot " << filename << " (" << g.num_nodes()
+              << " nodes, " << g.num_edges() << " edges)" << std::endl;
   }
-  return total_spread / double(mc_rounds);
-}
 
-struct NodeGain {
-  int node_id;
-  double marginal_gain;
-  int iteration_computed;
+  static void write(const Graph &g, std::ostream &out) {
+    uint64_t n = g.num_nodes();
+    uint64_t m = g.num_edges();
+    std::string attr_name;
+    for (const auto &name : g.value_names)
+      attr_name += (attr_name.empty() ? "" : "\n") + name;
 
-  bool operator<(const NodeGain &other) const {
-    if (marginal_gain == other.marginal_gain)
-      return node_id > other.node_id;
-    return marginal_gain < other.marginal_gain;
+    std::vector<uint64_t> name_offsets(n + 1, 0);
+    for (uint64_t u = 0; u < n; ++u)
+      name_offsets[u + 1] = name_offsets[u] + g.name(u).size();
+
+    Header h{};
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.byte_order = BYTE_ORDER_MARK;
+    h.attr_name_len = (uint32_t)attr_name.size();
+    h.num_nodes = n;
+    h.num_edges = m;
+    h.names_bytes = name_offsets[n];
+
+    uint64_t written = 0;
+    auto put = [&](const void *p, size_t bytes) {
+      out.write(static_cast<const char *>(p), bytes);
+      written += bytes;
+      static const char zeros[8] = {};
+      out.write(zeros, (8 - written % 8) % 8);
+      written += (8 - written % 8) % 8;
+    };
+    put(&h, sizeof(h));
+    put(attr_name.data(), attr_name.size());
+    put(g.offsets.data(), (n + 1) * sizeof(uint32_t));
+    put(g.targets.data(), m * sizeof(int32_t));
+    put(g.probabilities.data(), m * sizeof(float));
+    for (size_t c = 0; c < g.value_columns.size(); ++c) {
+      std::vector<double> values = g.value_columns[c];
+      std::vector<char> present = g.value_present[c];
+      values.resize(n, 0.0);
+      present.resize(n, 0);
+      put(values.data(), n * sizeof(double));
+      put(present.data(), n);
+    }
+    put(name_offsets.data(), name_offsets.size() * sizeof(uint64_t));
+    for (uint64_t u = 0; u < n; ++u)
+      out.write(g.name(u).data(), g.name(u).size());
+    out.flush();
   }
-};
 
-std::set<int> celf_weighted_influence(const Graph &g, int k, int mc_rounds) {
-  std::set<int> seeds;
-  std::priority_queue<NodeGain> pq;
+  static Graph read(const std::string &filename,
+                    const std::string &attr_name) {
+    return read(filename, std::vector<std::string>{attr_name});
+  }
 
-  int n = g.num_nodes();
-  std::cout << "Initializing CELF (calculating base weighted influence for "
-            << n << " nodes)..." << std::endl;
+  // loads the stored columns named in attr_names, in that order, and
+  // selects the first
+  static Graph read(const std::string &filename,
+                    const std::vector<std::string> &attr_names) {
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file(filename);
+    Graph g = read(file.data, file.size, filename, attr_names);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Loaded snapshot " << filename << " in " << elapsed.count()
+              << "s" << std::endl;
+    return g;
+  }
 
-#pragma omp parallel
-  {
-    std::priority_queue<NodeGain> local_pq;
-
-    std::random_device rd;
-    unsigned int tid = (unsigned)omp_get_thread_num();
-    unsigned int tcount = (unsigned)omp_get_num_threads();
-    std::seed_seq seq{rd(),
-                      (unsigned int)std::chrono::high_resolution_clock::now()
-                          .time_since_epoch()
-                          .count(),
-                      tid, tcount};
-    std::mt19937 rng(seq);
-
-#pragma omp for nowait
-    for (int i = 0; i < n; ++i) {
-      if (!g.has_value[i])
-        continue;
+  // same from a snapshot in memory; filename only labels errors
+  static Graph read(const char *base, size_t size,
+                    const std::string &filename,
+                    const std::vector<std::string> &attr_names) {
+    uint64_t pos = 0;
+    auto take = [&](uint64_t bytes) -> const char * {
+      if (pos + bytes > size)
+        throw std::runtime_error("Truncated snapshot " + filename);
+      const char *p = base + pos;
+      pos += bytes + (8 - bytes % 8) % 8;
+      return p;
+    };
 
-      std::vector<int> single = {i};
-      double spread = estimate_weighted_spread(g, single, mc_rounds, rng);
-      local_pq.push({i, spread, 0});
-    }
+    Header h;
+    std::memcpy(&h, take(sizeof(Header)), sizeof(Header));
+    if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+      throw std::runtime_error(filename + " is not a .wmig snapshot");
+    if (h.byte_order != BYTE_ORDER_MARK)
+      throw std::runtime_error("Snapshot " + filename +
+                               " was written on a different byte order");
+    if (h.version != VERSION && h.version != 2)
+      throw std::runtime_error("Snapshot " + filename + " has version " +
+                               std::to_string(h.version) + ", expected " +
+                               std::to_string(VERSION));
 
-#pragma omp critical
-    {
-      while (!local_pq.empty()) {
-        pq.push(local_pq.top());
-        local_pq.pop();
+    std::string_view stored_attrs(take(h.attr_name_len), h.attr_name_len);
+    std::vector<std::string_view> stored;
+    for (size_t begin = 0; begin <= stored_attrs.size();) {
+      size_t end = std::min(stored_attrs.find('\n', begin), stored_attrs.size());
+      stored.push_back(stored_attrs.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    std::vector<size_t> wanted;
+    for (const auto &attr : attr_names) {
+      auto it = std::find(stored.begin(), stored.end(), attr);
+      if (it == stored.end()) {
+        std::string list(stored_attrs);
+        std::replace(list.begin(), list.end(), '\n', ',');
+        throw std::runtime_error("Snapshot " + filename +
+                                 " was built for attribute '" + list +
+                                 "', not '" + attr + "'");
       }
+      wanted.push_back(it - stored.begin());
     }
-  }
 
-  double current_val = 0.0;
+    uint64_t n = h.num_nodes, m = h.num_edges;
+    auto corrupt = [&](const char *what) {
+      return std::runtime_error("Corrupt snapshot " + filename + ": " +
+                                what);
+    };
+    // every node and edge takes at least a byte, which also keeps the
+    // section sizes below from overflowing
+    if (n > size || m > size || h.names_bytes > size || n >= INT32_MAX ||
+        m > UINT32_MAX)
+      throw corrupt("sizes in the header do not fit the file");
+    auto offsets = reinterpret_cast<const uint32_t *>(
+        take((n + 1) * sizeof(uint32_t)));
+    auto targets =
+        reinterpret_cast<const int32_t *>(take(m * sizeof(int32_t)));
+    auto probs = reinterpret_cast<const float *>(take(m * sizeof(float)));
+    std::vector<const double *> values;
+    std::vector<const char *> has_value;
+    for (size_t c = 0; c < stored.size(); ++c) {
+      values.push_back(
+          reinterpret_cast<const double *>(take(n * sizeof(double))));
+      has_value.push_back(take(n));
+    }
+    auto name_offsets = reinterpret_cast<const uint64_t *>(
+        take((n + 1) * sizeof(uint64_t)));
+    const char *names = take(h.names_bytes);
 
-  for (int iteration = 0; iteration < k; ++iteration) {
-    bool found_best = false;
+    if (offsets[0] != 0 || offsets[n] != m)
+      throw corrupt("edge offsets do not span the edges");
+    for (uint64_t u = 0; u < n; ++u)
+      if (offsets[u] > offsets[u + 1])
+        throw corrupt("edge offsets are not sorted");
+    for (uint64_t e = 0; e < m; ++e)
+      if (targets[e] < 0 || (uint64_t)targets[e] >= n)
+        throw corrupt("edge target out of range");
+    if (name_offsets[0] != 0 || name_offsets[n] != h.names_bytes)
+      throw corrupt("name offsets do not span the names");
+    for (uint64_t u = 0; u < n; ++u)
+      if (name_offsets[u] > name_offsets[u + 1])
+        throw corrupt("name offsets are not sorted");
 
-    while (!found_best && !pq.empty()) {
-      NodeGain top = pq.top();
-      pq.pop();
+    Graph g;
+    g.reserve(n, 0);
+    for (uint64_t u = 0; u < n; ++u)
+      g.get_internal_id(std::string_view(names + name_offsets[u],
+                                         name_offsets[u + 1] -
+                                             name_offsets[u]));
+    if ((uint64_t)g.num_nodes() != n)
+      throw std::runtime_error("Duplicate node names in snapshot " +
+                               filename);
 
-      if (seeds.find(top.node_id) != seeds.end())
-        continue;
+    g.add_value_columns(attr_names);
+    for (size_t c = 0; c < wanted.size(); ++c) {
+      g.value_columns[c].assign(values[wanted[c]], values[wanted[c]] + n);
+      g.value_present[c].assign(has_value[wanted[c]],
+                                has_value[wanted[c]] + n);
+    }
+    g.offsets.assign(offsets, offsets + n + 1);
+    g.targets.assign(targets, targets + m);
+    g.probabilities.assign(probs, probs + m);
+    g.scale_thresholds();
+    g.use_values(0);
+    return g;
+  }
+};
 
-      if (top.iteration_computed == (int)seeds.size()) {
-        seeds.insert(top.node_id);
-        current_val += top.marginal_gain;
-        found_best = true;
-        std::cout << "Selected Node " << g.reverse_id_map[top.node_id]
-                  << " (Val: " << g.node_values[top.node_id] << ")"
-                  << " | Marginal Gain: " << top.marginal_gain
-                  << " | Total Weighted Reach: " << current_val << std::endl;
-      } else {
-        std::vector<int> temp_seeds(seeds.begin(), seeds.end());
-        temp_seeds.push_back(top.node_id);
+// the generators and edge_world_mask also run inside --gpu target regions
+#pragma omp declare target
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
 
-        std::random_device rd;
-        std::seed_seq seq{
-            rd(),
-            (unsigned int)std::chrono::high_resolution_clock::now()
-                .time_since_epoch()
-                .count(),
-            (unsigned int)top.node_id};
-        std::mt19937 rng(seq);
+// Counter-based generators: 64 random bits as a pure function of
+// (key, counter). Any position of any stream comes out directly, so there
+// is no state to seed or share between threads, and a run is reproducible
+// from its keys. fill() writes consecutive counters without branching so
+// the compiler can vectorize it.
+struct SplitMixCounter {
+  static uint64_t bits(uint64_t key, uint64_t counter) {
+    return splitmix64(key ^ (counter * 0xD6E8FEB86659FD93ull));
+  }
 
-        double new_val =
-            estimate_weighted_spread(g, temp_seeds, mc_rounds, rng);
-        double marginal_gain = new_val - current_val;
-        pq.push({top.node_id, marginal_gain, (int)seeds.size()});
-      }
-    }
+  static void fill(uint64_t key, uint64_t counter, int count, uint64_t *out) {
+    for (int i = 0; i < count; ++i)
+      out[i] = bits(key, counter + i);
+  }
+};
 
-    if (!found_best) {
-      std::cerr << "Warning: priority queue exhausted before selecting k=" << k
-                << " seeds. Selected " << seeds.size() << " seeds."
-                << std::endl;
-      break;
+// Philox4x32-10 (Salmon et al. 2011); slower than SplitMixCounter but a
+// well-studied generator, for runs that need to be checked against it
+struct Philox4x32 {
+  static uint64_t bits(uint64_t key, uint64_t counter) {
+    uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32);
+    uint32_t c2 = 0, c3 = 0;
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    for (int round = 0; round < 10; ++round) {
+      uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+      uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+      uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+      uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+      c1 = (uint32_t)p1;
+      c3 = (uint32_t)p0;
+      c0 = n0;
+      c2 = n2;
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
     }
+    return ((uint64_t)c1 << 32) | c0;
   }
 
-  return seeds;
+  static void fill(uint64_t key, uint64_t counter, int count, uint64_t *out) {
+    for (int i = 0; i < count; ++i)
+      out[i] = bits(key, counter + i);
+  }
+};
+
+#ifdef INFLUENCE_PHILOX
+using CounterRng = Philox4x32;
+#else
+using CounterRng = SplitMixCounter;
+#endif
+#pragma omp end declare target
+
+[[maybe_unused]] static uint64_t entropy_seed() {
+  std::random_device rd;
+  return ((uint64_t)rd() << 32) ^
+         (uint64_t)std::chrono::high_resolution_clock::now()
+             .time_since_epoch()
+             .count();
 }
 
-int main(int argc, char *argv[]) {
-  if (argc < 4 || argc > 5) {
-    std::cerr << "Usage: " << argv[0]
-              << " <gexf_file> <k> <attribute_name> [mc_rounds]" << std::endl;
-    return 1;
-  }
+// FNV-1a folded through splitmix64: a name hash that stays the same across
+// builds and platforms, for anything written to disk
+static uint64_t stable_hash(std::string_view s) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (unsigned char c : s)
+    h = (h ^ c) * 0x100000001B3ull;
+  return splitmix64(h);
+}
 
-  std::string filename = argv[1];
-  int k = std::stoi(argv[2]);
-  std::string attr_name = argv[3];
-  int mc_rounds = DEFAULT_MC_ROUNDS;
-  if (argc == 5)
-    mc_rounds = std::stoi(argv[4]);
+// live-edge test of edge e in the world identified by world_key
+static inline bool edge_live(uint64_t world_key, uint64_t e,
+                             uint32_t threshold) {
+  return (uint32_t)(CounterRng::bits(world_key, e) >> 32) < threshold;
+}
 
-  try {
-    std::cout << "Parsing GEXF..." << std::endl;
-    Graph g = GEXFParser::parse(filename, attr_name);
+// Event counters of one thread. The kernels add to their thread's block
+// once per call, so counting costs no shared cache lines.
+struct ThreadCounters {
+  int thread = 0;
+  long long cascades = 0;
+  long long edge_visits = 0;
+  long long activations = 0;
+  long long evaluations = 0;
+};
 
-    std::cout << "Nodes: " << g.num_nodes() << std::endl;
-    std::cout << "Eligible seeds (has attribute): ";
-    int eligible = 0;
-    for (int i = 0; i < g.num_nodes(); ++i)
-      if (g.has_value[i])
-        eligible++;
-    std::cout << eligible << std::endl;
-
-    std::cout << "Running Weighted CELF with mc_rounds=" << mc_rounds << "..."
-              << std::endl;
+// Run-wide instrumentation: named phases with wall and CPU time and the
+// counter deltas they saw, per-thread counters, and the CELF queue pops
+// of every iteration. Printed as a table at the end of a run and dumped
+// as JSON with --profile-json.
+class Profiler {
+public:
+  struct Phase {
+    std::string name;
+    double wall = 0.0;
+    double cpu = 0.0;
+    ThreadCounters counts;
+  };
 
-    auto start = std::chrono::high_resolution_clock::now();
-    std::set<int> seeds = celf_weighted_influence(g, k, mc_rounds);
-    auto end = std::chrono::high_resolution_clock::now();
+  static Profiler &get() {
+    static Profiler profiler;
+    return profiler;
+  }
 
-    std::cout << "---------------------------------" << std::endl;
-    std::cout << "Selected Seeds: ";
-    for (int s : seeds)
-      std::cout << g.reverse_id_map[s] << " ";
-    std::cout << std::endl;
+  ThreadCounters &local() {
+    thread_local ThreadCounters *mine = nullptr;
+    if (!mine) {
+      std::lock_guard<std::mutex> lock(mutex);
+      threads.push_back(std::make_unique<ThreadCounters>());
+      mine = threads.back().get();
+      mine->thread = omp_get_thread_num();
+    }
+    return *mine;
+  }
+
+  // sum over threads; only meaningful outside parallel regions
+  ThreadCounters total() const {
+    ThreadCounters sum;
+    for (const auto &t : threads) {
+      sum.cascades += t->cascades;
+      sum.edge_visits += t->edge_visits;
+      sum.activations += t->activations;
+      sum.evaluations += t->evaluations;
+    }
+    return sum;
+  }
+
+  void add_phase(Phase phase) { phases.push_back(std::move(phase)); }
+  void add_queue_pops(long long pops) { queue_pops.push_back(pops); }
+
+  void report(std::ostream &os) const {
+    char line[160];
+    os << "Profile:" << std::endl;
+    std::snprintf(line, sizeof(line), "  %-22s %9s %9s %12s %14s %12s",
+                  "phase", "wall s", "cpu s", "cascades", "edge visits",
+                  "edges/s");
+    os << line << std::endl;
+    for (const Phase &p : phases) {
+      std::snprintf(line, sizeof(line),
+                    "  %-22s %9.3f %9.3f %12lld %14lld %12.4g", p.name.c_str(),
+                    p.wall, p.cpu, p.counts.cascades, p.counts.edge_visits,
+                    p.wall > 0.0 ? p.counts.edge_visits / p.wall : 0.0);
+      os << line << std::endl;
+    }
+    ThreadCounters sum = total();
+    os << "  spread evaluations: " << sum.evaluations
+       << ", average cascade size: "
+       << (sum.cascades ? double(sum.activations) / sum.cascades : 0.0)
+       << " nodes" << std::endl;
+    if (!queue_pops.empty()) {
+      long long pops = 0, most = 0;
+      for (long long p : queue_pops) {
+        pops += p;
+        most = std::max(most, p);
+      }
+      os << "  CELF queue pops per iteration: avg "
+         << double(pops) / queue_pops.size() << ", max " << most << std::endl;
+    }
+    for (const auto &t : threads)
+      os << "  thread " << t->thread << ": " << t->cascades << " cascades, "
+         << t->edge_visits << " edge visits, " << t->evaluations
+         << " evaluations" << std::endl;
+  }
+
+  void write_json(const std::string &filename) const {
+    std::ofstream out(filename, std::ios::trunc);
+    if (!out.is_open())
+      throw std::runtime_error("Cannot open file " + filename);
+    auto counts = [&](const ThreadCounters &c) {
+      out << "\"cascades\":" << c.cascades
+          << ",\"edge_visits\":" << c.edge_visits
+          << ",\"activations\":" << c.activations
+          << ",\"evaluations\":" << c.evaluations;
+    };
+    out << "{\"phases\":[";
+    for (size_t i = 0; i < phases.size(); ++i) {
+      const Phase &p = phases[i];
+      out << (i ? "," : "") << "{\"name\":\"" << p.name
+          << "\",\"wall_s\":" << p.wall << ",\"cpu_s\":" << p.cpu << ",";
+      counts(p.counts);
+      out << "}";
+    }
+    out << "],\"total\":{";
+    counts(total());
+    out << "},\"celf_queue_pops\":[";
+    for (size_t i = 0; i < queue_pops.size(); ++i)
+      out << (i ? "," : "") << queue_pops[i];
+    out << "],\"threads\":[";
+    for (size_t i = 0; i < threads.size(); ++i) {
+      out << (i ? "," : "") << "{\"thread\":" << threads[i]->thread << ",";
+      counts(*threads[i]);
+      out << "}";
+    }
+    out << "]}" << std::endl;
+    if (!out)
+      throw std::runtime_error("Failed writing profile " + filename);
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadCounters>> threads;
+  std::vector<Phase> phases;
+  std::vector<long long> queue_pops;
+};
+
+// Times the enclosing scope, or up to stop(), as one profiler phase.
+class ScopedPhase {
+public:
+  explicit ScopedPhase(std::string name)
+      : name(std::move(name)), wall(std::chrono::steady_clock::now()),
+        cpu(std::clock()), before(Profiler::get().total()) {}
+
+  ~ScopedPhase() { stop(); }
+
+  void stop() {
+    if (stopped)
+      return;
+    stopped = true;
+    Profiler::Phase p;
+    p.name = name;
+    p.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           wall)
+                 .count();
+    p.cpu = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+    ThreadCounters after = Profiler::get().total();
+    p.counts.cascades = after.cascades - before.cascades;
+    p.counts.edge_visits = after.edge_visits - before.edge_visits;
+    p.counts.activations = after.activations - before.activations;
+    p.counts.evaluations = after.evaluations - before.evaluations;
+    Profiler::get().add_phase(std::move(p));
+  }
+
+private:
+  std::string name;
+  std::chrono::steady_clock::time_point wall;
+  std::clock_t cpu;
+  ThreadCounters before;
+  bool stopped = false;
+};
+
+// The process group of a distributed run. Built with -DUSE_MPI (mpic++)
+// every rank is one MPI process; otherwise, or when started without
+// mpirun, it is a single rank and every collective is a no-op, so the
+// engines call it unconditionally. Collectives are only issued outside of
+// OpenMP regions. The sums below are only ever applied to arrays where at
+// most one rank contributes a non-zero value per element, which keeps
+// results exact and equal to a single-process run.
+class Cluster {
+public:
+  static Cluster &get() {
+    static Cluster cluster;
+    return cluster;
+  }
+
+  void init(int &argc, char **&argv) {
+#ifdef USE_MPI
+    int provided = 0;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+    MPI_Comm_size(MPI_COMM_WORLD, &size_);
+    active = true;
+#else
+    (void)argc;
+    (void)argv;
+#endif
+  }
+
+  void finalize() {
+#ifdef USE_MPI
+    if (active)
+      MPI_Finalize();
+    active = false;
+#endif
+  }
+
+  // brings every rank down after an error on one of them, which would
+  // otherwise leave the others waiting in a collective
+  void abort(int code) {
+#ifdef USE_MPI
+    if (active && size_ > 1)
+      MPI_Abort(MPI_COMM_WORLD, code);
+#endif
+    (void)code;
+  }
+
+  int rank() const { return rank_; }
+  int size() const { return size_; }
+  bool root() const { return rank_ == 0; }
+
+  // element-wise sum over all ranks, in place
+  void sum(double *data, size_t count) {
+#ifdef USE_MPI
+    reduce(data, count, MPI_DOUBLE);
+#else
+    (void)data;
+    (void)count;
+#endif
+  }
+
+  void sum(int64_t *data, size_t count) {
+#ifdef USE_MPI
+    reduce(data, count, MPI_INT64_T);
+#else
+    (void)data;
+    (void)count;
+#endif
+  }
+
+  void broadcast(uint64_t &value) {
+#ifdef USE_MPI
+    if (size_ > 1)
+      MPI_Bcast(&value, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+#else
+    (void)value;
+#endif
+  }
+
+  // replaces bytes on every rank by those of rank 0
+  void broadcast(std::string &bytes) {
+#ifdef USE_MPI
+    if (size_ == 1)
+      return;
+    uint64_t length = bytes.size();
+    MPI_Bcast(&length, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    bytes.resize(length);
+    for (uint64_t done = 0; done < length;) {
+      int chunk = (int)std::min<uint64_t>(length - done, CHUNK);
+      MPI_Bcast(&bytes[done], chunk, MPI_CHAR, 0, MPI_COMM_WORLD);
+      done += chunk;
+    }
+#else
+    (void)bytes;
+#endif
+  }
+
+private:
+#ifdef USE_MPI
+  // MPI counts are ints
+  static constexpr size_t CHUNK = size_t(1) << 28;
+
+  template <typename T>
+  void reduce(T *data, size_t count, MPI_Datatype type) {
+    if (size_ == 1)
+      return;
+    for (size_t done = 0; done < count;) {
+      int chunk = (int)std::min(count - done, CHUNK);
+      MPI_Allreduce(MPI_IN_PLACE, data + done, chunk, type, MPI_SUM,
+                    MPI_COMM_WORLD);
+      done += chunk;
+    }
+  }
+
+  bool active = false;
+#endif
+  int rank_ = 0;
+  int size_ = 1;
+};
+
+// Per-thread state of a single-world cascade, kept across calls: a node is
+// active when last_seen holds the current token, so starting a cascade
+// costs one increment instead of clearing n entries, and queue keeps its
+// capacity.
+struct TokenScratch {
+  std::vector<unsigned int> last_seen;
+  unsigned int token = 0;
+  std::vector<int> queue;
+
+  explicit TokenScratch(int n) : last_seen(n, 0u), queue(n) {}
+
+  // token of a fresh cascade; last_seen is cleared once per 2^32 of them
+  unsigned int next_token() {
+    if (++token == 0) {
+      std::fill(last_seen.begin(), last_seen.end(), 0u);
+      token = 1;
+    }
+    return token;
+  }
+};
+
+double run_weighted_simulation_token(const Graph &g,
+                                     const std::vector<int> &seed_list,
+                                     uint64_t world_key, TokenScratch &s,
+                                     int max_depth = 0) {
+  unsigned int seen_token = s.next_token();
+  std::vector<unsigned int> &last_seen = s.last_seen;
+  // every node enters the queue at most once, so it never outgrows n
+  int *q = s.queue.data();
+  size_t head = 0, tail = 0;
+  double total_value = 0.0;
+  long long edges = 0, activated = 0;
+
+  for (int src : seed_list) {
+    if (last_seen[src] != seen_token) {
+      last_seen[src] = seen_token;
+      q[tail++] = src;
+      total_value += g.node_values[src];
+    }
+  }
+
+  // the queue holds one hop level after the other; with max_depth > 0,
+  // nodes max_depth hops out are activated but not expanded
+  int depth = 0;
+  size_t level_end = tail;
+  while (head < tail) {
+    if (head == level_end) {
+      depth++;
+      level_end = tail;
+    }
+    int u = q[head++];
+    activated++;
+    if (max_depth > 0 && depth >= max_depth)
+      continue;
+    edges += g.out_degree(u);
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+      int v = g.targets[e];
+      if (last_seen[v] != seen_token &&
+          edge_live(world_key, e, g.thresholds[e])) {
+        last_seen[v] = seen_token;
+        total_value += g.node_values[v];
+        q[tail++] = v;
+      }
+    }
+  }
+  ThreadCounters &c = Profiler::get().local();
+  c.cascades++;
+  c.edge_visits += edges;
+  c.activations += activated;
+  return total_value;
+}
+
+// Coins of edge e for the worlds of the block identified by block_key,
+// restricted to the worlds set in open. Each 64-bit word holds four 16-bit
+// lanes, the coins of four consecutive worlds, compared against the top of
+// the edge threshold. Dense masks take all 16 words in one batch, sparse
+// ones only the groups they touch. Pure function of (block_key, e, world),
+// so re-expanding an edge always sees the same coins.
+#pragma omp declare target
+static inline uint64_t edge_world_mask(uint64_t block_key, uint32_t e,
+                                       uint32_t threshold, uint64_t open) {
+  if (threshold == 0u)
+    return 0ull;
+  if (threshold == UINT32_MAX)
+    return open;
+  uint64_t counter = (uint64_t)e << 4;
+  uint64_t mask = 0ull;
+  auto lanes = [&](int group, uint64_t h) {
+    for (int lane = 0; lane < 4; ++lane)
+      if ((uint32_t)((h >> (16 * lane)) & 0xFFFFu) << 16 < threshold)
+        mask |= 1ull << (group * 4 + lane);
+  };
+  if (__builtin_popcountll(open) > 32) {
+    uint64_t words[16];
+    CounterRng::fill(block_key, counter, 16, words);
+    for (int group = 0; group < 16; ++group)
+      lanes(group, words[group]);
+    return mask & open;
+  }
+  while (open) {
+    int group = __builtin_ctzll(open) >> 2;
+    lanes(group, CounterRng::bits(block_key, counter + group));
+    open &= ~(0xFull << (group * 4));
+  }
+  return mask;
+}
+#pragma omp end declare target
+
+// Per-thread state of a bit-parallel cascade: bit j of active[v] says v is
+// active in world j of the current block, pending[v] holds the bits v has
+// not propagated yet. Depth-bounded cascades collect the bits of the next
+// hop level in incoming/next, sized on first use.
+struct BlockScratch {
+  std::vector<uint64_t> active;
+  std::vector<uint64_t> pending;
+  std::vector<int> queue;
+  std::vector<int> touched;
+  std::vector<uint64_t> incoming;
+  std::vector<int> next;
+
+  explicit BlockScratch(int n) : active(n, 0ull), pending(n, 0ull) {}
+
+  void reset() {
+    for (int v : touched)
+      active[v] = 0ull;
+    touched.clear();
+  }
+};
+
+// Grows the cascades of all 64 worlds of one block at once from sources.
+// Nodes whose bit is set in reached (one word per node, may be null) or
+// already active in s are skipped, so consecutive calls without reset()
+// continue the same cascades. Returns the summed fixed-point value of the
+// newly activated (node, world) pairs. The lists in s keep their capacity
+// across calls, so a warm scratch runs a cascade without allocating.
+//
+// With max_depth > 0 the cascade is grown one hop level at a time and stops
+// max_depth hops from the sources, i.e. it activates exactly the nodes
+// within max_depth live edges of a source in each world. A node that is
+// already active or reached still blocks the cascade, so a continued cascade
+// counts what lies within max_depth hops of the new sources through
+// inactive nodes only.
+int64_t run_bitparallel_block(const Graph &g, const int *sources,
+                              size_t count, uint64_t block_key, uint64_t valid,
+                              const uint64_t *reached, BlockScratch &s,
+                              int max_depth = 0) {
+  int64_t total_value = 0;
+  long long edges = 0, activated = 0;
+  s.queue.clear();
+  auto activate = [&](int v, uint64_t add, std::vector<uint64_t> &bits,
+                      std::vector<int> &list) {
+    activated += __builtin_popcountll(add);
+    if (s.active[v] == 0ull)
+      s.touched.push_back(v);
+    s.active[v] |= add;
+    total_value += g.fixed_values[v] * __builtin_popcountll(add);
+    if (bits[v] == 0ull)
+      list.push_back(v);
+    bits[v] |= add;
+  };
+  auto expand = [&](int u, std::vector<uint64_t> &bits,
+                    std::vector<int> &list) {
+    uint64_t d = s.pending[u];
+    s.pending[u] = 0ull;
+    edges += g.out_degree(u);
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+      int v = g.targets[e];
+      uint64_t open = d & ~s.active[v] & (reached ? ~reached[v] : ~0ull);
+      if (!open)
+        continue;
+      uint64_t add =
+          open & edge_world_mask(block_key, e, g.thresholds[e], open);
+      if (add)
+        activate(v, add, bits, list);
+    }
+  };
+
+  for (size_t i = 0; i < count; ++i) {
+    int src = sources[i];
+    uint64_t add = valid & ~s.active[src] & (reached ? ~reached[src] : ~0ull);
+    if (add)
+      activate(src, add, s.pending, s.queue);
+  }
+  if (max_depth <= 0) {
+    for (size_t head = 0; head < s.queue.size(); ++head)
+      expand(s.queue[head], s.pending, s.queue);
+  } else {
+    if (s.incoming.size() < s.pending.size())
+      s.incoming.assign(s.pending.size(), 0ull);
+    for (int depth = 0; depth < max_depth && !s.queue.empty(); ++depth) {
+      s.next.clear();
+      for (int u : s.queue)
+        expand(u, s.incoming, s.next);
+      for (int v : s.next) {
+        s.pending[v] = s.incoming[v];
+        s.incoming[v] = 0ull;
+      }
+      s.queue.swap(s.next);
+    }
+    for (int v : s.queue)
+      s.pending[v] = 0ull;
+  }
+  ThreadCounters &c = Profiler::get().local();
+  c.cascades += __builtin_popcountll(valid);
+  c.edge_visits += edges;
+  c.activations += activated;
+  return total_value;
+}
+
+int64_t run_bitparallel_block(const Graph &g, const std::vector<int> &sources,
+                              uint64_t block_key, uint64_t valid,
+                              const uint64_t *reached, BlockScratch &s,
+                              int max_depth = 0) {
+  return run_bitparallel_block(g, sources.data(), sources.size(), block_key,
+                               valid, reached, s, max_depth);
+}
+
+static inline uint64_t block_valid_mask(int worlds, int block) {
+  int bits = std::min(64, worlds - block * 64);
+  return bits == 64 ? ~0ull : (1ull << bits) - 1;
+}
+
+// scratch the offload kernel keeps on the device, split into one slot of
+// six n-sized arrays per concurrent cascade
+static constexpr size_t OFFLOAD_POOL_BYTES = size_t(256) << 20;
+
+// device of the --gpu target regions; without one they run on the host
+static inline int offload_device() {
+  return omp_get_num_devices() > 0 ? omp_get_default_device()
+                                   : omp_get_initial_device();
+}
+
+// run_bitparallel_block from a single source and no reached set, as an
+// OpenMP target region: sums[i * blocks + b] is the fixed-point value the
+// cascade of nodes[i] reaches in block b. Each team grows one (node,
+// block) cascade a hop level at a time, its threads claiming (node, world)
+// bits with an atomic or. What a live-edge world reaches within max_depth
+// hops does not depend on the visiting order and the coins are the same
+// edge_world_mask draws, so every sum equals the CPU kernel's. Returns the
+// edge visits.
+long long offload_block_spreads(const Graph &g, const uint64_t *block_keys,
+                                int blocks, int worlds, const int *nodes,
+                                size_t count, int max_depth, int64_t *sums) {
+  size_t n = g.num_nodes(), m = g.num_edges();
+  size_t tasks = count * blocks;
+  if (tasks == 0)
+    return 0;
+  size_t per_slot = n * (3 * sizeof(uint64_t) + 3 * sizeof(int));
+  size_t slots = std::max<size_t>(
+      1, std::min(tasks, OFFLOAD_POOL_BYTES / std::max<size_t>(per_slot, 1)));
+  int device = offload_device();
+  auto bits = (uint64_t *)omp_target_alloc(slots * 3 * n * sizeof(uint64_t),
+                                           device);
+  auto lists = (int *)omp_target_alloc(slots * 3 * n * sizeof(int), device);
+  if (!bits || !lists) {
+    omp_target_free(bits, device);
+    omp_target_free(lists, device);
+    throw std::runtime_error("Cannot allocate " +
+                             std::to_string(slots * per_slot >> 20) +
+                             " MB on the offload device");
+  }
+  const uint32_t *offsets = g.offsets.data();
+  const int *targets = g.targets.data();
+  const uint32_t *thresholds = g.thresholds.data();
+  const int64_t *values = g.fixed_values.data();
+  std::vector<long long> edges(slots);
+  long long *edge_counts = edges.data();
+  long long total_edges = 0;
+
+#pragma omp target data device(device)                                     \
+    map(to : offsets[0 : n + 1], targets[0 : m], thresholds[0 : m],          \
+            values[0 : n], block_keys[0 : blocks], nodes[0 : count])
+  {
+#pragma omp target teams distribute parallel for device(device)            \
+    is_device_ptr(bits)
+    for (size_t i = 0; i < slots * 3 * n; ++i)
+      bits[i] = 0ull;
+
+    for (size_t first = 0; first < tasks; first += slots) {
+      size_t batch = std::min(slots, tasks - first);
+#pragma omp target teams distribute device(device) is_device_ptr(bits, lists) \
+    map(from : sums[first : batch], edge_counts[0 : batch])
+      for (size_t t = 0; t < batch; ++t) {
+        size_t task = first + t;
+        int source = nodes[task / blocks];
+        int b = (int)(task % blocks);
+        uint64_t key = block_keys[b];
+        int left = worlds - b * 64;
+        uint64_t valid = left >= 64 ? ~0ull : (1ull << left) - 1;
+        // active: bits reached so far; level: bits v spreads this hop;
+        // incoming: bits v gets for the next hop
+        uint64_t *active = bits + t * 3 * n, *level = active + n,
+                 *incoming = level + n;
+        int *frontier = lists + t * 3 * n, *next = frontier + n,
+            *touched = next + n;
+        int size = 1, next_size = 0, touched_size = 1;
+        int64_t total = values[source] * __builtin_popcountll(valid);
+        long long visits = 0;
+        active[source] = level[source] = valid;
+        frontier[0] = touched[0] = source;
+        for (int depth = 0; size > 0 && (max_depth <= 0 || depth < max_depth);
+             ++depth) {
+          next_size = 0;
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : total, visits)
+          for (int i = 0; i < size; ++i) {
+            int u = frontier[i];
+            uint64_t d = level[u];
+            visits += offsets[u + 1] - offsets[u];
+            for (uint32_t e = offsets[u]; e < offsets[u + 1]; ++e) {
+              int v = targets[e];
+              uint64_t seen;
+#pragma omp atomic read
+              seen = active[v];
+              uint64_t open = d & ~seen;
+              if (!open)
+                continue;
+              uint64_t add =
+                  open & edge_world_mask(key, e, thresholds[e], open);
+              if (!add)
+                continue;
+              uint64_t old;
+#pragma omp atomic capture
+              {
+                old = active[v];
+                active[v] |= add;
+              }
+              add &= ~old;
+              if (!add)
+                continue;
+              total += values[v] * __builtin_popcountll(add);
+              int slot;
+              if (old == 0ull) {
+#pragma omp atomic capture
+                slot = touched_size++;
+                touched[slot] = v;
+              }
+#pragma omp atomic capture
+              {
+                old = incoming[v];
+                incoming[v] |= add;
+              }
+              if (old == 0ull) {
+#pragma omp atomic capture
+                slot = next_size++;
+                next[slot] = v;
+              }
+            }
+          }
+          for (int i = 0; i < size; ++i)
+            level[frontier[i]] = 0ull;
+          for (int i = 0; i < next_size; ++i) {
+            level[next[i]] = incoming[next[i]];
+            incoming[next[i]] = 0ull;
+          }
+          int *spent = frontier;
+          frontier = next;
+          next = spent;
+          size = next_size;
+        }
+        for (int i = 0; i < size; ++i)
+          level[frontier[i]] = 0ull;
+        for (int i = 0; i < touched_size; ++i)
+          active[touched[i]] = 0ull;
+        sums[task] = total;
+        edge_counts[t] = visits;
+      }
+      for (size_t t = 0; t < batch; ++t)
+        total_edges += edge_counts[t];
+    }
+  }
+  omp_target_free(bits, device);
+  omp_target_free(lists, device);
+  return total_edges;
+}
+
+// Welford's running mean and variance
+struct RunningStats {
+  long long count = 0;
+  double mean = 0.0;
+  double m2 = 0.0;
+
+  void add(double x) {
+    count++;
+    double d = x - mean;
+    mean += d / count;
+    m2 += d * (x - mean);
+  }
+
+  double variance() const { return count > 1 ? m2 / (count - 1) : 0.0; }
+
+  // half width of the normal confidence interval of the mean
+  double half_width(double z) const {
+    return count > 1 ? z * std::sqrt(variance() / count) : HUGE_VAL;
+  }
+};
+
+// Adaptive estimates look at their running interval after 4, 8, 16, ...
+// blocks of 64 worlds (always the same blocks, whatever the thread count),
+// and stop once its 99% half width is within tolerance of the mean.
+static constexpr double ADAPTIVE_Z = 2.576;
+static constexpr int ADAPTIVE_FIRST_CHECK = 4;
+// CELF re-evaluates stale heads this many at a time under adaptive
+// sampling; the batch decides which best gain an estimate is held against,
+// so it must not follow the thread or rank count
+static constexpr size_t ADAPTIVE_BATCH = 4;
+
+static inline int next_checkpoint(int done, int blocks, double tolerance) {
+  if (tolerance <= 0.0)
+    return blocks;
+  return std::min(blocks, done < ADAPTIVE_FIRST_CHECK ? ADAPTIVE_FIRST_CHECK
+                                                      : 2 * done);
+}
+
+static inline bool precise_enough(const RunningStats &stats,
+                                  double tolerance) {
+  return stats.half_width(ADAPTIVE_Z) <= tolerance * std::fabs(stats.mean);
+}
+
+// mc_rounds fresh worlds drawn from the stream of seed, using the
+// caller's scratch; with tolerance > 0 sampling stops early once the
+// estimate is that precise, and rounds_used (if given) receives the number
+// of worlds it took
+double estimate_weighted_spread(const Graph &g,
+                                const std::vector<int> &seed_list,
+                                int mc_rounds, uint64_t seed, BlockScratch &s,
+                                int max_depth = 0, double tolerance = 0.0,
+                                int *rounds_used = nullptr) {
+  double total_spread = 0.0;
+  Profiler::get().local().evaluations++;
+  RunningStats stats;
+  int blocks = (mc_rounds + 63) / 64, b = 0, rounds = 0;
+  while (b < blocks) {
+    for (int stop = next_checkpoint(b, blocks, tolerance); b < stop; ++b) {
+      uint64_t block_key = CounterRng::bits(seed, b);
+      uint64_t valid = block_valid_mask(mc_rounds, b);
+      double value = g.from_fixed(run_bitparallel_block(
+          g, seed_list, block_key, valid, nullptr, s, max_depth));
+      s.reset();
+      total_spread += value;
+      rounds += __builtin_popcountll(valid);
+      stats.add(value / __builtin_popcountll(valid));
+    }
+    if (precise_enough(stats, tolerance))
+      break;
+  }
+  if (rounds_used)
+    *rounds_used = rounds;
+  return total_spread / double(rounds);
+}
+
+// same, for a one-off estimate
+double estimate_weighted_spread(const Graph &g,
+                                const std::vector<int> &seed_list,
+                                int mc_rounds, uint64_t seed,
+                                int max_depth = 0) {
+  BlockScratch s(g.num_nodes());
+  return estimate_weighted_spread(g, seed_list, mc_rounds, seed, s,
+                                  max_depth);
+}
+
+// CELF++ look-ahead: gain of a node given the seeds, and given the seeds
+// plus the iteration's best candidate
+struct LookAheadEstimate {
+  double gain = 0.0;
+  double look_ahead_gain = 0.0;
+  // worlds averaged over, and the top of the 99% interval of gain
+  // (adaptive sampling only, HUGE_VAL otherwise)
+  int worlds = 0;
+  double upper = HUGE_VAL;
+};
+
+// A fixed sample of live-edge worlds shared by every CELF evaluation
+// (common random numbers), plus the per-world set of nodes already reached
+// by the selected seeds. Worlds come in blocks of 64 that are simulated
+// together by run_bitparallel_block; reached holds one word per (block,
+// node). A candidate's marginal gain only explores nodes outside the
+// reached set, so it costs the candidate's exclusive reach and is never
+// negative. With max_depth > 0 every cascade is cut max_depth hops out.
+//
+// With a sampling tolerance, an estimate stops after the blocks of the
+// first checkpoint where it is precise enough, or where its interval lies
+// entirely below the `below` threshold passed by the caller.
+class PossibleWorlds {
+public:
+  // cascade state plus the per-block results of one estimate, so that an
+  // estimate with a warm scratch does not allocate
+  struct Scratch : BlockScratch {
+    std::vector<LookAheadEstimate> per_block;
+
+    explicit Scratch(int n) : BlockScratch(n) {}
+  };
+
+  PossibleWorlds(const Graph &g, int worlds, uint64_t seed, int max_depth = 0)
+      : g(g), worlds(worlds), n(g.num_nodes()), max_depth(max_depth) {
+    for (int b = 0; b * 64 < worlds; ++b)
+      block_keys.push_back(CounterRng::bits(seed, b));
+    reached.assign(block_keys.size() * n, 0ull);
+  }
+
+  int size() const { return worlds; }
+  int blocks() const { return (int)block_keys.size(); }
+  size_t cache_bytes() const { return reached.size() * sizeof(uint64_t); }
+  void set_tolerance(double t) { tolerance = t; }
+  bool adaptive() const { return tolerance > 0.0; }
+
+  // average exclusive value of node over all worlds; with look_ahead >= 0
+  // also the gain once look_ahead has been added
+  LookAheadEstimate gain(int node, int look_ahead, Scratch &s,
+                         double below = -HUGE_VAL) const {
+    Profiler::get().local().evaluations++;
+    std::vector<LookAheadEstimate> &per_block = s.per_block;
+    per_block.resize(blocks());
+    RunningStats stats;
+    int b = 0;
+    while (b < blocks()) {
+      for (int stop = next_checkpoint(b, blocks(), tolerance); b < stop; ++b)
+        add_block(per_block, b, stats, block_gain(node, look_ahead, s, b));
+      if (settled(stats, below))
+        break;
+    }
+    return average(per_block, b, stats);
+  }
+
+  // same, with the blocks up to each checkpoint split across the team; the
+  // results go to the buffer of the first scratch
+  LookAheadEstimate gain_parallel(int node, int look_ahead,
+                                  std::vector<Scratch> &scratch,
+                                  double below = -HUGE_VAL) const {
+    Profiler::get().local().evaluations++;
+    std::vector<LookAheadEstimate> &per_block = scratch[0].per_block;
+    per_block.resize(blocks());
+    RunningStats stats;
+    int b = 0;
+    while (b < blocks()) {
+      int stop = next_checkpoint(b, blocks(), tolerance);
+#pragma omp parallel for schedule(dynamic, 1)
+      for (int i = b; i < stop; ++i)
+        per_block[i] =
+            block_gain(node, look_ahead, scratch[omp_get_thread_num()], i);
+      for (; b < stop; ++b)
+        add_block(per_block, b, stats, per_block[b]);
+      if (settled(stats, below))
+        break;
+    }
+    return average(per_block, b, stats);
+  }
+
+  // gain(node, -1).gain of every node, with the cascades run by
+  // offload_block_spreads; only meaningful before the first add_seed().
+  // The first node's block sums are checked against the CPU kernel.
+  std::vector<double> initial_gains_offload(const std::vector<int> &nodes,
+                                            Scratch &s) const {
+    std::vector<int64_t> sums(nodes.size() * blocks());
+    long long edges =
+        offload_block_spreads(g, block_keys.data(), blocks(), worlds,
+                              nodes.data(), nodes.size(), max_depth,
+                              sums.data());
+    for (int b = 0; b < blocks() && !nodes.empty(); ++b) {
+      int64_t cpu = run_bitparallel_block(g, &nodes[0], 1, block_keys[b],
+                                          block_valid_mask(worlds, b),
+                                          nullptr, s, max_depth);
+      s.reset();
+      if (cpu != sums[b])
+        throw std::runtime_error(
+            "Offloaded spread of " + std::string(g.name(nodes[0])) +
+            " differs from the CPU kernel in block " + std::to_string(b));
+    }
+    std::vector<double> gains(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      double total = 0.0;
+      for (int b = 0; b < blocks(); ++b)
+        total += g.from_fixed(sums[i * blocks() + b]);
+      gains[i] = total / worlds;
+    }
+    ThreadCounters &c = Profiler::get().local();
+    c.cascades += (long long)nodes.size() * worlds;
+    c.edge_visits += edges;
+    c.evaluations += nodes.size();
+    return gains;
+  }
+
+  // marks everything node reaches as reached, in every world
+  void add_seed(int node, std::vector<Scratch> &scratch) {
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < blocks(); ++b) {
+      Scratch &s = scratch[omp_get_thread_num()];
+      uint64_t *r = &reached[(size_t)b * n];
+      run_bitparallel_block(g, &node, 1, block_keys[b],
+                            block_valid_mask(worlds, b), r, s, max_depth);
+      for (int v : s.touched)
+        r[v] |= s.active[v];
+      s.reset();
+    }
+  }
+
+private:
+  LookAheadEstimate block_gain(int node, int look_ahead, Scratch &s,
+                               int b) const {
+    LookAheadEstimate est;
+    const uint64_t *r = &reached[(size_t)b * n];
+    uint64_t valid = block_valid_mask(worlds, b);
+    est.gain = g.from_fixed(run_bitparallel_block(
+        g, &node, 1, block_keys[b], valid, r, s, max_depth));
+    s.reset();
+    if (look_ahead >= 0) {
+      run_bitparallel_block(g, &look_ahead, 1, block_keys[b], valid, r, s,
+                            max_depth);
+      est.look_ahead_gain = g.from_fixed(run_bitparallel_block(
+          g, &node, 1, block_keys[b], valid, r, s, max_depth));
+      s.reset();
+    }
+    return est;
+  }
+
+  int block_worlds(int b) const {
+    return __builtin_popcountll(block_valid_mask(worlds, b));
+  }
+
+  void add_block(std::vector<LookAheadEstimate> &per_block, int b,
+                 RunningStats &stats, const LookAheadEstimate &est) const {
+    per_block[b] = est;
+    if (adaptive())
+      stats.add(est.gain / block_worlds(b));
+  }
+
+  bool settled(const RunningStats &stats, double below) const {
+    return adaptive() && (precise_enough(stats, tolerance) ||
+                          stats.mean + stats.half_width(ADAPTIVE_Z) < below);
+  }
+
+  // sums of the first used blocks in block order, so the result does not
+  // depend on which thread computed which block
+  LookAheadEstimate average(const std::vector<LookAheadEstimate> &per_block,
+                            int used, const RunningStats &stats) const {
+    LookAheadEstimate est;
+    for (int b = 0; b < used; ++b) {
+      est.gain += per_block[b].gain;
+      est.look_ahead_gain += per_block[b].look_ahead_gain;
+    }
+    est.worlds = used == blocks() ? worlds : used * 64;
+    est.gain /= est.worlds;
+    est.look_ahead_gain /= est.worlds;
+    if (adaptive() && used < blocks())
+      est.upper = est.gain + stats.half_width(ADAPTIVE_Z);
+    return est;
+  }
+
+  const Graph &g;
+  int worlds;
+  size_t n;
+  int max_depth;
+  double tolerance = 0.0;
+  std::vector<uint64_t> block_keys;
+  std::vector<uint64_t> reached;
+};
+
+// Cheap proxy for the cost of a cascade from each node: expected live
+// out-edges plus those of the expected successors (two hops).
+std::vector<double> estimate_cascade_cost(const Graph &g) {
+  int n = g.num_nodes();
+  std::vector<double> out_p(n, 0.0), cost(n, 0.0);
+#pragma omp parallel for schedule(static)
+  for (int u = 0; u < n; ++u)
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+      out_p[u] += g.probabilities[e];
+#pragma omp parallel for schedule(static)
+  for (int u = 0; u < n; ++u) {
+    double c = 1.0 + g.out_degree(u);
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+      c += g.probabilities[e] * g.out_degree(g.targets[e]);
+    cost[u] = c + out_p[u];
+  }
+  return cost;
+}
+
+// Strongly connected components of the part of g reachable from the nodes
+// with keep[u] set, by iterative Tarjan. Components come out in reverse
+// topological order, so every edge leaving component c points to a
+// component with a smaller id; members lists them grouped by component.
+struct Condensation {
+  std::vector<int> component;
+  std::vector<uint32_t> offsets;
+  std::vector<int> members;
+  int nodes = 0;
+  long long edges = 0;
+  long long dag_edges = 0;
+  int largest = 0;
+  int nontrivial = 0;
+
+  int size() const { return (int)offsets.size() - 1; }
+};
+
+Condensation condense(const Graph &g, const std::vector<char> &keep) {
+  int n = g.num_nodes();
+  Condensation c;
+  c.component.assign(n, -1);
+  c.offsets.push_back(0);
+  std::vector<int> index(n, -1), low(n, 0), stack;
+  std::vector<std::pair<int, uint32_t>> call;
+  int counter = 0;
+  auto enter = [&](int v) {
+    index[v] = low[v] = counter++;
+    stack.push_back(v);
+    call.push_back({v, g.offsets[v]});
+  };
+  for (int root = 0; root < n; ++root) {
+    if (!keep[root] || index[root] >= 0)
+      continue;
+    enter(root);
+    while (!call.empty()) {
+      int u = call.back().first;
+      uint32_t &e = call.back().second;
+      if (e < g.offsets[u + 1]) {
+        int v = g.targets[e++];
+        if (index[v] < 0)
+          enter(v);
+        else if (c.component[v] < 0)
+          low[u] = std::min(low[u], index[v]);
+        continue;
+      }
+      call.pop_back();
+      if (!call.empty())
+        low[call.back().first] = std::min(low[call.back().first], low[u]);
+      if (low[u] != index[u])
+        continue;
+      int id = c.size();
+      int v;
+      do {
+        v = stack.back();
+        stack.pop_back();
+        c.component[v] = id;
+        c.members.push_back(v);
+      } while (v != u);
+      c.offsets.push_back((uint32_t)c.members.size());
+      int members = int(c.offsets[id + 1] - c.offsets[id]);
+      c.largest = std::max(c.largest, members);
+      c.nontrivial += members > 1;
+    }
+  }
+
+  c.nodes = (int)c.members.size();
+  std::vector<int> stamp(c.size(), -1);
+  for (int id = 0; id < c.size(); ++id)
+    for (uint32_t i = c.offsets[id]; i < c.offsets[id + 1]; ++i) {
+      int u = c.members[i];
+      c.edges += g.out_degree(u);
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+        int t = c.component[g.targets[e]];
+        if (t != id && stamp[t] != id) {
+          stamp[t] = id;
+          c.dag_edges++;
+        }
+      }
+    }
+  return c;
+}
+
+// Analytic spreads for the candidates whose cascade needs no simulation,
+// and an upper bound for all the others.
+//
+// A node whose out-neighbours all have in-degree 1 and are themselves
+// tree-rooted reaches an out-tree: every reachable node has exactly one
+// path from it, so its expected spread is exactly
+// val(u) + sum p(u,v) * spread(v). Leaves (out-degree 0) are the base case.
+// For everything else spread(u) <= val(u) + sum p(u,v) * spread(v) still
+// holds (each reached node is reached through some live out-edge). On the
+// condensation the same argument bounds a whole component C by its total
+// value plus sum p(x,v) * bound(v) over the edges leaving it, which one
+// pass in topological order settles without iterating around cycles; a
+// few node-level sweeps of the first map then tighten the members.
+struct SpreadBounds {
+  std::vector<double> upper;
+  std::vector<char> exact;
+  int leaves = 0;
+  int trees = 0;
+};
+
+SpreadBounds bound_spreads(const Graph &g, const Condensation &scc,
+                           int sweeps = 2) {
+  int n = g.num_nodes();
+  SpreadBounds b;
+  b.upper.assign(n, 0.0);
+  b.exact.assign(n, 0);
+
+  std::vector<int> in_degree(n, 0), parent(n, -1), open(n, 0);
+  for (int u = 0; u < n; ++u)
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+      in_degree[g.targets[e]]++;
+      parent[g.targets[e]] = u;
+    }
+  // open[u]: children not yet known to be tree-rooted; -1 once one of them
+  // is shared, which rules u out for good
+  std::vector<int> ready;
+  for (int u = 0; u < n; ++u) {
+    open[u] = g.out_degree(u);
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+      if (in_degree[g.targets[e]] != 1)
+        open[u] = -1;
+    if (open[u] == 0)
+      ready.push_back(u);
+  }
+  for (size_t head = 0; head < ready.size(); ++head) {
+    int u = ready[head];
+    double spread = g.node_values[u];
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+      spread += g.probabilities[e] * b.upper[g.targets[e]];
+    b.upper[u] = spread;
+    b.exact[u] = 1;
+    if (g.has_value[u])
+      (g.out_degree(u) == 0 ? b.leaves : b.trees)++;
+    // u has in-degree 1 unless it is a root, so at most one parent waits
+    int p = in_degree[u] == 1 ? parent[u] : -1;
+    if (p >= 0 && open[p] > 0 && --open[p] == 0)
+      ready.push_back(p);
+  }
+
+  for (int id = 0; id < scc.size(); ++id) {
+    uint32_t first = scc.offsets[id], last = scc.offsets[id + 1];
+    if (last - first == 1 && b.exact[scc.members[first]])
+      continue;
+    double bound = 0.0;
+    for (uint32_t i = first; i < last; ++i) {
+      int u = scc.members[i];
+      bound += std::max(0.0, g.node_values[u]);
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+        if (scc.component[g.targets[e]] != id)
+          bound += g.probabilities[e] * std::max(0.0, b.upper[g.targets[e]]);
+    }
+    for (uint32_t i = first; i < last; ++i)
+      b.upper[scc.members[i]] = bound;
+  }
+
+  for (int sweep = 0; sweep < sweeps; ++sweep) {
+    bool changed = false;
+    for (int u : scc.members) {
+      if (b.exact[u])
+        continue;
+      double bound = std::max(0.0, g.node_values[u]);
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+        bound += g.probabilities[e] * std::max(0.0, b.upper[g.targets[e]]);
+      if (bound < b.upper[u]) {
+        changed = changed || b.upper[u] - bound > 1e-9 * b.upper[u];
+        b.upper[u] = bound;
+      }
+    }
+    if (!changed)
+      break;
+  }
+  return b;
+}
+
+// wall time each thread spent inside a parallel phase
+static void report_thread_busy(const char *phase,
+                               const std::vector<double> &busy,
+                               const std::vector<long long> &items) {
+  double lo = *std::min_element(busy.begin(), busy.end());
+  double hi = *std::max_element(busy.begin(), busy.end());
+  double sum = 0.0;
+  for (double b : busy)
+    sum += b;
+  double avg = sum / busy.size();
+  std::cerr << phase << ": thread busy min " << lo << "s, avg " << avg
+            << "s, max " << hi << "s (imbalance "
+            << (avg > 0.0 ? hi / avg : 1.0) << ")" << std::endl;
+  for (size_t t = 0; t < busy.size(); ++t)
+    std::cerr << "  thread " << t << ": " << busy[t] << "s, " << items[t]
+              << " items" << std::endl;
+}
+
+static bool ends_with(std::string_view s, std::string_view suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Hands every selected seed on as soon as it is chosen: the usual line on
+// stdout and, with a stream path, one JSON object (or CSV row for a .csv
+// path) per seed, flushed right away so downstream jobs can start on the
+// first seeds. JSON streams also carry the progress events.
+class SeedReporter {
+public:
+  SeedReporter(const Graph &g, const std::string &path = "")
+      : g(g), csv(ends_with(path, ".csv")),
+        start(std::chrono::steady_clock::now()) {
+    if (path.empty())
+      return;
+    stream.open(path, std::ios::trunc);
+    if (!stream.is_open())
+      throw std::runtime_error("Cannot open file " + path);
+    if (csv)
+      stream << "rank,package,value,marginal_gain,total_weighted_reach,"
+                "elapsed_s\n"
+             << std::flush;
+  }
+
+  void selected(int node, double marginal_gain, double total) {
+    order.push_back(node);
+    std::cout << "Selected Node " << g.name(node)
+              << " (Val: " << g.node_values[node] << ")"
+              << " | Marginal Gain: " << marginal_gain
+              << " | Total Weighted Reach: " << total << std::endl;
+    if (!stream.is_open())
+      return;
+    if (csv)
+      stream << order.size() << "," << csv_field(g.name(node)) << ","
+             << g.node_values[node] << "," << marginal_gain << "," << total
+             << "," << elapsed() << "\n";
+    else
+      stream << "{\"event\":\"seed\",\"rank\":" << order.size()
+             << ",\"package\":\"" << json_string(g.name(node))
+             << "\",\"value\":" << g.node_values[node]
+             << ",\"marginal_gain\":" << marginal_gain
+             << ",\"total_weighted_reach\":" << total
+             << ",\"elapsed_s\":" << elapsed() << "}\n";
+    stream.flush();
+  }
+
+  // done of total units of phase finished, at rate cascades per second
+  void progress(const char *phase, long long done, long long total,
+                double rate, double eta) {
+    std::cerr << phase << ": " << done << "/" << total << " candidates, "
+              << rate << " cascades/s, ETA " << eta << "s" << std::endl;
+    if (!stream.is_open() || csv)
+      return;
+    stream << "{\"event\":\"progress\",\"phase\":\"" << phase
+           << "\",\"done\":" << done << ",\"total\":" << total
+           << ",\"cascades_per_s\":" << rate << ",\"eta_s\":" << eta
+           << ",\"elapsed_s\":" << elapsed() << "}" << std::endl;
+  }
+
+  // seeds in selection order
+  const std::vector<int> &seeds() const { return order; }
+  bool chosen(int node) const {
+    return std::find(order.begin(), order.end(), node) != order.end();
+  }
+
+  static std::string json_string(std::string_view s) {
+    std::string out;
+    for (unsigned char c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += (char)c;
+      } else if (c < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out += (char)c;
+      }
+    }
+    return out;
+  }
+
+private:
+  double elapsed() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
+
+  static std::string csv_field(std::string_view s) {
+    if (s.find_first_of(",\"\r\n") == std::string_view::npos)
+      return std::string(s);
+    std::string out = "\"";
+    for (char c : s) {
+      if (c == '"')
+        out += '"';
+      out += c;
+    }
+    return out + "\"";
+  }
+
+  const Graph &g;
+  bool csv;
+  std::ofstream stream;
+  std::chrono::steady_clock::time_point start;
+  std::vector<int> order;
+};
+
+struct NodeGain {
+  int node_id;
+  double marginal_gain;
+  int iteration_computed;
+  // CELF++: best candidate of the iteration when marginal_gain was computed,
+  // and the gain of this node given seeds + {prev_best}
+  int prev_best;
+  double mg2;
+
+  bool operator<(const NodeGain &other) const {
+    if (marginal_gain == other.marginal_gain)
+      return node_id > other.node_id;
+    return marginal_gain < other.marginal_gain;
+  }
+};
+
+// CELF counters, kept in checkpoints so that a resumed run reports the
+// totals of the whole run
+struct CelfCounters {
+  long long evaluations = 0;
+  long long look_ahead_hits = 0;
+  // worlds used and worlds available over all adaptive estimates
+  double adaptive_used = 0.0;
+  double adaptive_total = 0.0;
+  long long adaptive_bounded = 0;
+};
+
+// priority queue whose entries can be read out for a checkpoint
+class CelfQueue : public std::priority_queue<NodeGain> {
+public:
+  const std::vector<NodeGain> &entries() const { return c; }
+};
+
+// State of a CELF run between two iterations: the queue, the seeds so far
+// with their gains, and the counters, plus what the run was started with.
+// The reached-set cache is left out, a resumed run rebuilds it by adding
+// the seeds again. Worlds come from counter-based streams of the seed, so
+// nothing else of the RNG needs saving. The file holds header | seeds |
+// gains | queue, every section 8-byte aligned.
+class CelfCheckpoint {
+public:
+  static constexpr char MAGIC[4] = {'W', 'M', 'C', 'K'};
+  static constexpr uint32_t VERSION = 1;
+
+  uint64_t seed = 0;
+  uint64_t graph = 0;
+  int mc_rounds = 0;
+  int max_depth = 0;
+  double tolerance = 0.0;
+  int k = 0;
+  std::vector<int> seeds;
+  std::vector<double> gains;
+  CelfCounters counters;
+  std::vector<NodeGain> queue;
+
+  // hash of everything the gains depend on: names, values and edges
+  static uint64_t fingerprint(const Graph &g) {
+    uint64_t h = splitmix64(g.num_nodes() ^ (g.num_edges() << 32));
+    for (int u = 0; u < g.num_nodes(); ++u) {
+      h = splitmix64(h ^ stable_hash(g.name(u)));
+      h = splitmix64(h ^ (uint64_t)g.fixed_values[u] ^
+                     ((uint64_t)g.has_value[u] << 63));
+      h = splitmix64(h ^ g.offsets[u + 1]);
+    }
+    for (size_t e = 0; e < g.num_edges(); ++e)
+      h = splitmix64(h ^ (uint64_t)g.targets[e] ^
+                     ((uint64_t)g.thresholds[e] << 32));
+    return h;
+  }
+
+  // written next to filename and renamed over it, so a crash while
+  // writing keeps the previous checkpoint
+  void write(const std::string &filename) const {
+    Header h{};
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.byte_order = GraphSnapshot::BYTE_ORDER_MARK;
+    h.k = k;
+    h.seed = seed;
+    h.graph = graph;
+    h.mc_rounds = mc_rounds;
+    h.max_depth = max_depth;
+    h.tolerance = tolerance;
+    h.num_seeds = seeds.size();
+    h.queue_size = queue.size();
+    h.evaluations = counters.evaluations;
+    h.look_ahead_hits = counters.look_ahead_hits;
+    h.adaptive_used = counters.adaptive_used;
+    h.adaptive_total = counters.adaptive_total;
+    h.adaptive_bounded = counters.adaptive_bounded;
+    std::vector<Entry> entries(queue.size());
+    for (size_t i = 0; i < queue.size(); ++i)
+      entries[i] = {queue[i].node_id, queue[i].iteration_computed,
+                    queue[i].prev_best, 0, queue[i].marginal_gain,
+                    queue[i].mg2};
+
+    std::string temp = filename + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+      throw std::runtime_error("Cannot open file " + temp);
+    uint64_t written = 0;
+    auto put = [&](const void *p, size_t bytes) {
+      out.write(static_cast<const char *>(p), bytes);
+      written += bytes;
+      static const char zeros[8] = {};
+      out.write(zeros, (8 - written % 8) % 8);
+      written += (8 - written % 8) % 8;
+    };
+    put(&h, sizeof(h));
+    put(seeds.data(), seeds.size() * sizeof(int32_t));
+    put(gains.data(), gains.size() * sizeof(double));
+    put(entries.data(), entries.size() * sizeof(Entry));
+    out.close();
+    if (!out || std::rename(temp.c_str(), filename.c_str()) != 0)
+      throw std::runtime_error("Failed writing checkpoint " + filename);
+  }
+
+  static CelfCheckpoint read(const char *data, size_t size,
+                             const std::string &filename) {
+    uint64_t pos = 0;
+    auto take = [&](uint64_t bytes) -> const char * {
+      if (pos > size || bytes > size - pos)
+        throw std::runtime_error("Truncated checkpoint " + filename);
+      const char *p = data + pos;
+      pos += bytes + (8 - bytes % 8) % 8;
+      return p;
+    };
+    Header h;
+    std::memcpy(&h, take(sizeof(Header)), sizeof(Header));
+    if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+      throw std::runtime_error(filename + " is not a CELF checkpoint");
+    if (h.byte_order != GraphSnapshot::BYTE_ORDER_MARK)
+      throw std::runtime_error("Checkpoint " + filename +
+                               " was written on a different byte order");
+    if (h.version != VERSION)
+      throw std::runtime_error("Checkpoint " + filename + " has version " +
+                               std::to_string(h.version) + ", expected " +
+                               std::to_string(VERSION));
+    // the counts are checked against the bytes left before anything is
+    // sized by them, which also keeps the section sizes from overflowing
+    if (h.k < 0 || h.num_seeds > (uint64_t)h.k)
+      throw std::runtime_error("Corrupt checkpoint " + filename +
+                               ": more seeds than k");
+    uint64_t left = size - pos;
+    if (h.num_seeds > left / (sizeof(int32_t) + sizeof(double)) ||
+        h.queue_size > left / sizeof(Entry))
+      throw std::runtime_error("Truncated checkpoint " + filename);
+    CelfCheckpoint c;
+    c.k = h.k;
+    c.seed = h.seed;
+    c.graph = h.graph;
+    c.mc_rounds = h.mc_rounds;
+    c.max_depth = h.max_depth;
+    c.tolerance = h.tolerance;
+    c.counters = {h.evaluations, h.look_ahead_hits, h.adaptive_used,
+                  h.adaptive_total, h.adaptive_bounded};
+    c.seeds.resize(h.num_seeds);
+    c.gains.resize(h.num_seeds);
+    std::memcpy(c.seeds.data(), take(h.num_seeds * sizeof(int32_t)),
+                h.num_seeds * sizeof(int32_t));
+    std::memcpy(c.gains.data(), take(h.num_seeds * sizeof(double)),
+                h.num_seeds * sizeof(double));
+    std::vector<Entry> entries(h.queue_size);
+    std::memcpy(entries.data(), take(h.queue_size * sizeof(Entry)),
+                h.queue_size * sizeof(Entry));
+    for (const Entry &e : entries)
+      c.queue.push_back(
+          {e.node, e.marginal_gain, e.iteration, e.prev_best, e.mg2});
+    return c;
+  }
+
+  // rank 0 reads filename, every rank gets the same checkpoint
+  static CelfCheckpoint load(const std::string &filename) {
+    std::string bytes;
+    Cluster &cluster = Cluster::get();
+    if (cluster.root()) {
+      MappedFile file(filename);
+      bytes.assign(file.data ? file.data : "", file.size);
+    }
+    cluster.broadcast(bytes);
+    return read(bytes.data(), bytes.size(), filename);
+  }
+
+  // throws unless the checkpoint belongs to a run with these settings on
+  // this graph
+  void check(const Graph &g, uint64_t run_seed, int run_mc_rounds,
+             int run_max_depth, double run_tolerance) const {
+    if (run_seed != seed || run_mc_rounds != mc_rounds ||
+        run_max_depth != max_depth || run_tolerance != tolerance)
+      throw std::runtime_error(
+          "Checkpoint was written with --seed " + std::to_string(seed) +
+          ", mc_rounds " + std::to_string(mc_rounds) + ", --max-depth " +
+          std::to_string(max_depth) + " and --adaptive " +
+          std::to_string(tolerance) + "; resume with the same settings");
+    if (fingerprint(g) != graph)
+      throw std::runtime_error("Checkpoint was written for a different "
+                               "graph or attribute");
+    for (int u : seeds)
+      if (u < 0 || u >= g.num_nodes())
+        throw std::runtime_error("Checkpoint names a node out of range");
+    for (const NodeGain &e : queue)
+      if (e.node_id < 0 || e.node_id >= g.num_nodes())
+        throw std::runtime_error("Checkpoint names a node out of range");
+  }
+
+private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t k;
+    uint64_t seed;
+    uint64_t graph;
+    int32_t mc_rounds;
+    int32_t max_depth;
+    double tolerance;
+    uint64_t num_seeds;
+    uint64_t queue_size;
+    int64_t evaluations;
+    int64_t look_ahead_hits;
+    double adaptive_used;
+    double adaptive_total;
+    int64_t adaptive_bounded;
+  };
+
+  struct Entry {
+    int32_t node;
+    int32_t iteration;
+    int32_t prev_best;
+    int32_t unused;
+    double marginal_gain;
+    double mg2;
+  };
+};
+
+// Builds the initial CELF queue.
+static void celf_initial_queue(const Graph &g, int k, int mc_rounds,
+                               PossibleWorlds &worlds,
+                               std::vector<PossibleWorlds::Scratch> &scratch,
+                               SeedReporter &out, int max_depth, bool gpu,
+                               CelfQueue &pq, CelfCounters &counters) {
+  int n = g.num_nodes();
+  // candidates with an analytic spread skip the simulation; the others
+  // are only simulated up front if their upper bound could still beat the
+  // k-th best lower bound (exact spreads, or the value reached in one hop),
+  // the rest enter the queue stale with the bound as their key and are
+  // simulated only if they ever reach the top
+  ScopedPhase pruning("CELF pruning");
+  Condensation scc = condense(g, g.has_value);
+  std::cerr << "SCC condensation: " << scc.nodes << " reachable nodes and "
+            << scc.edges << " edges -> " << scc.size() << " components and "
+            << scc.dag_edges << " DAG edges ("
+            << (scc.nodes ? 100.0 * (scc.nodes - scc.size()) / scc.nodes : 0.0)
+            << "% fewer nodes, " << scc.nontrivial
+            << " cyclic components, largest " << scc.largest << ")"
+            << std::endl;
+  SpreadBounds bounds = bound_spreads(g, scc);
+  // the bounds still hold for depth-bounded cascades, but of the exact
+  // spreads only those of leaves do
+  if (max_depth > 0)
+    for (int i = 0; i < n; ++i)
+      if (bounds.exact[i] && g.out_degree(i) > 0) {
+        bounds.exact[i] = 0;
+        bounds.trees -= g.has_value[i];
+      }
+  // parallel edges (kept from GEXF input) reach their target together
+  // with probability 1 - prod(1 - p), so each distinct target counts once
+  std::vector<int> stamp(n, -1);
+  std::vector<double> miss(n, 1.0);
+  std::vector<double> known;
+  for (int i = 0; i < n; ++i) {
+    if (!g.has_value[i])
+      continue;
+    double lower = bounds.upper[i];
+    if (!bounds.exact[i]) {
+      lower = g.node_values[i];
+      for (uint32_t e = g.offsets[i]; e < g.offsets[i + 1]; ++e) {
+        int t = g.targets[e];
+        if (t == i)
+          continue;
+        if (stamp[t] != i) {
+          stamp[t] = i;
+          miss[t] = 1.0;
+        }
+        miss[t] *= 1.0 - g.probabilities[e];
+      }
+      for (uint32_t e = g.offsets[i]; e < g.offsets[i + 1]; ++e) {
+        int t = g.targets[e];
+        if (t != i && stamp[t] == i) {
+          lower += (1.0 - miss[t]) * g.node_values[t];
+          stamp[t] = -1;
+        }
+      }
+    }
+    known.push_back(lower);
+  }
+  double cutoff = -HUGE_VAL;
+  if (k > 0 && (int)known.size() >= k) {
+    std::nth_element(known.begin(), known.begin() + (k - 1), known.end(),
+                     std::greater<double>());
+    cutoff = known[k - 1];
+  }
+
+  // cascade costs are very skewed (a few hubs reach huge subtrees), so the
+  // candidates are handed out most expensive first, one at a time, to
+  // whichever thread is free
+  std::vector<double> cost = estimate_cascade_cost(g);
+  std::vector<int> order;
+  int deferred = 0, exact = 0;
+  for (int i = 0; i < n; ++i) {
+    if (!g.has_value[i])
+      continue;
+    if (bounds.exact[i]) {
+      pq.push({i, bounds.upper[i], 0, -1, 0.0});
+      exact++;
+    } else if (bounds.upper[i] < cutoff) {
+      pq.push({i, bounds.upper[i], -1, -1, 0.0});
+      deferred++;
+    } else {
+      order.push_back(i);
+    }
+  }
+  std::cerr << "CELF pruning: " << exact << " exact (" << bounds.leaves
+            << " leaves, " << bounds.trees << " trees), " << deferred
+            << " deferred by upper bound, " << order.size() << " simulated"
+            << std::endl;
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return cost[a] != cost[b] ? cost[a] > cost[b] : a < b;
+  });
+  pruning.stop();
+
+  // with several ranks each one takes every size-th candidate of the cost
+  // order, which keeps their loads balanced, and the spreads are summed.
+  // Under adaptive sampling a candidate whose interval ends below the
+  // cutoff stops early and enters the queue stale, keyed by that end.
+  ScopedPhase init("CELF init");
+  Cluster &cluster = Cluster::get();
+  std::vector<size_t> mine;
+  for (size_t j = cluster.rank(); j < order.size(); j += cluster.size())
+    mine.push_back(j);
+  std::vector<double> spreads(order.size(), 0.0);
+  std::vector<double> uppers(order.size(), 0.0);
+  std::vector<double> used(order.size(), 0.0);
+  std::vector<double> busy(scratch.size(), 0.0);
+  std::vector<long long> evaluated(scratch.size(), 0);
+  long long done = 0, candidates = (long long)mine.size();
+  // cascades actually run, from the profiler's counters; adaptive
+  // estimates stop short of mc_rounds
+  long long cascades = 0;
+  double init_start = omp_get_wtime(), last_report = init_start;
+
+  if (gpu && !mine.empty()) {
+    std::vector<int> nodes;
+    for (size_t j : mine)
+      nodes.push_back(order[j]);
+    std::cout << "Running " << nodes.size() << " initial spreads on "
+              << (omp_get_num_devices() > 0
+                      ? "offload device " + std::to_string(offload_device())
+                      : std::string("the host (no offload device)"))
+              << "..." << std::endl;
+    std::vector<double> gains = worlds.initial_gains_offload(nodes, scratch[0]);
+    for (size_t m = 0; m < mine.size(); ++m) {
+      spreads[mine[m]] = gains[m];
+      uppers[mine[m]] = HUGE_VAL;
+      used[mine[m]] = mc_rounds;
+    }
+    mine.clear();
+  }
+
+#pragma omp parallel
+  {
+    int tid = omp_get_thread_num();
+    PossibleWorlds::Scratch &local = scratch[tid];
+    ThreadCounters &thread_counters = Profiler::get().local();
+    double started = omp_get_wtime();
+
+#pragma omp for schedule(dynamic, 1) nowait
+    for (size_t m = 0; m < mine.size(); ++m) {
+      size_t j = mine[m];
+      long long ran = thread_counters.cascades;
+      LookAheadEstimate est = worlds.gain(order[j], -1, local, cutoff);
+      ran = thread_counters.cascades - ran;
+#pragma omp atomic
+      cascades += ran;
+      spreads[j] = est.gain;
+      uppers[j] = est.upper;
+      used[j] = est.worlds;
+      evaluated[tid]++;
+      long long finished;
+#pragma omp atomic capture
+      finished = ++done;
+      // the master thread reports every couple of seconds
+      double now = omp_get_wtime();
+      if (tid == 0 && now - last_report >= 2.0 && finished < candidates) {
+        last_report = now;
+        long long ran;
+#pragma omp atomic read
+        ran = cascades;
+        double per_s = finished / (now - init_start);
+        out.progress("CELF init", finished, candidates,
+                     ran / (now - init_start),
+                     (candidates - finished) / per_s);
+      }
+    }
+    busy[tid] = omp_get_wtime() - started;
+  }
+  cluster.sum(spreads.data(), spreads.size());
+  cluster.sum(uppers.data(), uppers.size());
+  cluster.sum(used.data(), used.size());
+  for (size_t j = 0; j < order.size(); ++j) {
+    counters.adaptive_used += used[j];
+    counters.adaptive_total += mc_rounds;
+    if (uppers[j] < cutoff) {
+      pq.push({order[j], uppers[j], -1, -1, 0.0});
+      counters.adaptive_bounded++;
+    } else {
+      pq.push({order[j], spreads[j], 0, -1, 0.0});
+    }
+  }
+
+  init.stop();
+  report_thread_busy("CELF init", busy, evaluated);
+}
+
+// With a checkpoint path the state is saved after the initial queue and
+// after every seed; with resume the run picks up from a saved state
+// instead of building the queue, and goes on until k seeds.
+std::vector<int> celf_weighted_influence(const Graph &g, int k, int mc_rounds,
+                                         uint64_t seed, SeedReporter &out,
+                                         int max_depth = 0, bool gpu = false,
+                                         double tolerance = 0.0,
+                                         const std::string &checkpoint = "",
+                                         const CelfCheckpoint *resume =
+                                             nullptr) {
+  CelfQueue pq;
+
+  int n = g.num_nodes();
+  PossibleWorlds worlds(g, mc_rounds, seed, max_depth);
+  worlds.set_tolerance(tolerance);
+  std::vector<PossibleWorlds::Scratch> scratch(
+      std::max(1, omp_get_max_threads()), PossibleWorlds::Scratch(n));
+  Cluster &cluster = Cluster::get();
+  CelfCounters counters;
+  double current_val = 0.0;
+  int last_seed = -1;
+  std::vector<double> seed_gains;
+
+  if (resume) {
+    resume->check(g, seed, mc_rounds, max_depth, tolerance);
+    if ((int)resume->seeds.size() > k)
+      throw std::runtime_error(
+          "Checkpoint already holds " + std::to_string(resume->seeds.size()) +
+          " seeds, more than k=" + std::to_string(k));
+    std::cout << "Resuming CELF from a checkpoint with "
+              << resume->seeds.size() << " of " << k << " seeds and "
+              << resume->queue.size() << " queued candidates..."
+              << std::endl;
+    ScopedPhase replay("CELF resume");
+    for (const NodeGain &entry : resume->queue)
+      pq.push(entry);
+    counters = resume->counters;
+    for (size_t i = 0; i < resume->seeds.size(); ++i) {
+      int u = resume->seeds[i];
+      worlds.add_seed(u, scratch);
+      last_seed = u;
+      current_val += resume->gains[i];
+      seed_gains.push_back(resume->gains[i]);
+      out.selected(u, resume->gains[i], current_val);
+    }
+  } else {
+    std::cout << "Initializing CELF (calculating base weighted influence for "
+              << n << " nodes over " << mc_rounds << " sampled worlds in "
+              << worlds.blocks() << " bit-parallel sweeps, "
+              << worlds.cache_bytes() / (1024 * 1024)
+              << " MB reached-set cache)..." << std::endl;
+    celf_initial_queue(g, k, mc_rounds, worlds, scratch, out, max_depth, gpu,
+                       pq, counters);
+  }
+
+  uint64_t graph = checkpoint.empty() ? 0 : CelfCheckpoint::fingerprint(g);
+  auto save = [&]() {
+    if (checkpoint.empty() || !cluster.root())
+      return;
+    CelfCheckpoint state;
+    state.seed = seed;
+    state.graph = graph;
+    state.mc_rounds = mc_rounds;
+    state.max_depth = max_depth;
+    state.tolerance = tolerance;
+    state.k = k;
+    state.seeds = out.seeds();
+    state.gains = seed_gains;
+    state.counters = counters;
+    state.queue = pq.entries();
+    state.write(checkpoint);
+  };
+  save();
+
+
+  ScopedPhase selection("CELF selection");
+  // rank 0's team size, so that ranks with other thread counts build the
+  // same batches and sum gain arrays of the same length
+  uint64_t threads = std::max(1, omp_get_max_threads());
+  cluster.broadcast(threads);
+  size_t batch_size =
+      worlds.adaptive() ? ADAPTIVE_BATCH : threads * cluster.size();
+  // batch buffers, reused across batches
+  std::vector<NodeGain> batch, resolved;
+  std::vector<double> gains;
+  std::vector<char> bounded;
+
+  for (int iteration = (int)out.seeds().size(); iteration < k;
+       ++iteration) {
+    bool found_best = false;
+    int s = (int)out.seeds().size();
+    // node with the largest gain computed so far in this iteration
+    int cur_best = -1;
+    double cur_best_gain = 0.0;
+    auto note_fresh = [&](const NodeGain &entry) {
+      if (cur_best < 0 || entry.marginal_gain > cur_best_gain) {
+        cur_best = entry.node_id;
+        cur_best_gain = entry.marginal_gain;
+      }
+    };
+    // a gain computed last iteration against seeds + {last_seed} is exactly
+    // the gain against the current seeds
+    auto resolve_by_look_ahead = [&](NodeGain &entry) {
+      if (last_seed < 0 || entry.prev_best != last_seed ||
+          entry.iteration_computed != s - 1)
+        return false;
+      entry.marginal_gain = entry.mg2;
+      entry.iteration_computed = s;
+      entry.prev_best = -1;
+      counters.look_ahead_hits++;
+      note_fresh(entry);
+      return true;
+    };
+
+    long long pops = 0;
+    while (!found_best && !pq.empty()) {
+      NodeGain top = pq.top();
+      pq.pop();
+      pops++;
+
+      if (out.chosen(top.node_id))
+        continue;
+
+      if (top.iteration_computed == s) {
+        worlds.add_seed(top.node_id, scratch);
+        last_seed = top.node_id;
+        current_val += top.marginal_gain;
+        found_best = true;
+        out.selected(top.node_id, top.marginal_gain, current_val);
+        seed_gains.push_back(top.marginal_gain);
+        save();
+      } else if (resolve_by_look_ahead(top)) {
+        pq.push(top);
+      } else {
+        // take every stale head up to the next fresh entry (one per thread)
+        // and re-evaluate them together; a single stale head gets all
+        // threads for its worlds instead
+        batch.assign(1, top);
+        resolved.clear();
+        while (batch.size() < batch_size && !pq.empty() &&
+               pq.top().iteration_computed != s) {
+          NodeGain entry = pq.top();
+          pq.pop();
+          pops++;
+          if (resolve_by_look_ahead(entry))
+            resolved.push_back(entry);
+          else
+            batch.push_back(entry);
+        }
+        int look_ahead = cur_best;
+
+        // an adaptive estimate that ends below the best gain so far
+        // cannot win this iteration; it goes back stale, keyed by the top
+        // of its interval
+        double below = cur_best >= 0 ? cur_best_gain : -HUGE_VAL;
+        bounded.assign(batch.size(), 0);
+        auto apply = [&](size_t b, const LookAheadEstimate &est) {
+          NodeGain &entry = batch[b];
+          counters.adaptive_used += est.worlds;
+          counters.adaptive_total += mc_rounds;
+          if (est.upper < below) {
+            bounded[b] = 1;
+            entry.marginal_gain = est.upper;
+            entry.prev_best = -1;
+            counters.adaptive_bounded++;
+          } else {
+            entry.marginal_gain = est.gain;
+            entry.mg2 = est.look_ahead_gain;
+          }
+        };
+        for (auto &entry : batch)
+          entry.prev_best = entry.node_id == look_ahead ? -1 : look_ahead;
+
+        if (batch.size() == 1) {
+          apply(0, worlds.gain_parallel(batch[0].node_id, batch[0].prev_best,
+                                        scratch, below));
+        } else {
+          // entries are dealt out to the ranks like the initial candidates
+          gains.assign(4 * batch.size(), 0.0);
+          size_t first = cluster.rank(), stride = cluster.size();
+#pragma omp parallel for schedule(dynamic, 1)
+          for (size_t b = first; b < batch.size(); b += stride) {
+            LookAheadEstimate est =
+                worlds.gain(batch[b].node_id, batch[b].prev_best,
+                            scratch[omp_get_thread_num()], below);
+            gains[4 * b] = est.gain;
+            gains[4 * b + 1] = est.look_ahead_gain;
+            gains[4 * b + 2] = est.worlds;
+            gains[4 * b + 3] = est.upper;
+          }
+          cluster.sum(gains.data(), gains.size());
+          for (size_t b = 0; b < batch.size(); ++b)
+            apply(b, {gains[4 * b], gains[4 * b + 1], (int)gains[4 * b + 2],
+                      gains[4 * b + 3]});
+        }
+        counters.evaluations += batch.size();
+
+        for (size_t b = 0; b < batch.size(); ++b) {
+          NodeGain &entry = batch[b];
+          entry.iteration_computed = bounded[b] ? -1 : s;
+          if (!bounded[b])
+            note_fresh(entry);
+          pq.push(entry);
+        }
+        for (auto &entry : resolved)
+          pq.push(entry);
+      }
+    }
+    Profiler::get().add_queue_pops(pops);
+
+    if (!found_best) {
+      std::cerr << "Warning: priority queue exhausted before selecting k=" << k
+                << " seeds. Selected " << out.seeds().size() << " seeds."
+                << std::endl;
+      break;
+    }
+  }
+
+  std::cerr << "CELF++: " << counters.evaluations << " re-evaluations, "
+            << counters.look_ahead_hits << " resolved by look-ahead"
+            << std::endl;
+  if (worlds.adaptive() && counters.adaptive_total > 0)
+    std::cerr << "Adaptive MC: "
+              << (long long)(counters.adaptive_total / mc_rounds)
+              << " estimates averaged "
+              << counters.adaptive_used / counters.adaptive_total * mc_rounds
+              << " of " << mc_rounds << " worlds ("
+              << 100.0 * (1.0 - counters.adaptive_used /
+                                    counters.adaptive_total)
+              << "% saved), " << counters.adaptive_bounded
+              << " stopped below the best gain" << std::endl;
+  return out.seeds();
+}
+
+// Reverse-reachable sets for weighted RIS. Each set is rooted at a node drawn
+// with probability node_values[v] / total_weight and holds the eligible
+// nodes that reach the root in one sampled live-edge world, so
+// total_weight * (fraction of sets hit by S) is an unbiased spread estimate.
+// Edge coins are keyed by the names of the edge's endpoints instead of its
+// CSR position, so a set re-walked in a refreshed graph sees the same world
+// on every edge that still exists.
+//
+// In a distributed run every rank holds the sets whose index is its rank
+// modulo the number of ranks, and select() sums the coverage counts.
+class RRSets {
+public:
+  RRSets(const Graph &g, uint64_t seed)
+      : g(g), seed(seed), rank(Cluster::get().rank()),
+        ranks(Cluster::get().size()) {
+    int n = g.num_nodes();
+    in_offsets.assign(n + 1, 0);
+    for (int u = 0; u < n; ++u)
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+        in_offsets[g.targets[e] + 1]++;
+    for (int v = 0; v < n; ++v)
+      in_offsets[v + 1] += in_offsets[v];
+    std::vector<uint64_t> name_hash(n);
+#pragma omp parallel for schedule(static)
+    for (int v = 0; v < n; ++v)
+      name_hash[v] = stable_hash(g.name(v));
+    in_sources.resize(g.num_edges());
+    in_thresholds.resize(g.num_edges());
+    in_keys.resize(g.num_edges());
+    std::vector<uint32_t> fill(in_offsets.begin(), in_offsets.end() - 1);
+    for (int u = 0; u < n; ++u)
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+        int v = g.targets[e];
+        uint32_t slot = fill[v]++;
+        in_sources[slot] = u;
+        in_thresholds[slot] = g.thresholds[e];
+        in_keys[slot] =
+            splitmix64(name_hash[u] ^ (name_hash[v] * 0x9E3779B97F4A7C15ull));
+      }
+
+    for (int v = 0; v < n; ++v)
+      if (g.node_values[v] > 0.0) {
+        total_weight += g.node_values[v];
+        roots.push_back(v);
+        root_cdf.push_back(total_weight);
+      }
+  }
+
+  // sets over all ranks; offsets and nodes only hold the local ones
+  size_t size() const { return total_sets; }
+
+  // samples sets in parallel until count sets exist
+  void generate_until(size_t count) {
+    if (count <= size() || roots.empty())
+      return;
+    // the local sets among indices size() .. count - 1 are first, first +
+    // ranks, ...
+    size_t first = size() + (rank + ranks - size() % ranks) % ranks;
+    size_t missing = first < count ? (count - first + ranks - 1) / ranks : 0;
+    total_sets = count;
+    int threads = omp_get_max_threads();
+    std::vector<std::vector<int>> local_nodes(threads);
+    std::vector<std::vector<uint32_t>> local_sizes(threads);
+    std::vector<std::vector<int>> local_roots(threads);
+
+#pragma omp parallel
+    {
+      int tid = omp_get_thread_num();
+      std::vector<unsigned int> last_seen(g.num_nodes(), 0u);
+      std::vector<int> queue;
+      unsigned int token = 0;
+
+// static: contiguous index ranges in thread order, so the concatenated sets
+// stay in index order whatever the team size
+#pragma omp for schedule(static)
+      for (int64_t i = 0; i < (int64_t)missing; ++i) {
+        // a set is keyed by its index alone
+        uint64_t set_key = CounterRng::bits(seed, first + i * ranks);
+        size_t before = local_nodes[tid].size();
+        int root = sample_root(uniform(CounterRng::bits(set_key, UINT64_MAX)));
+        walk(root, set_key, last_seen, token, queue, local_nodes[tid]);
+        local_roots[tid].push_back(root);
+        local_sizes[tid].push_back(local_nodes[tid].size() - before);
+      }
+    }
+
+    for (int t = 0; t < threads; ++t) {
+      nodes.insert(nodes.end(), local_nodes[t].begin(), local_nodes[t].end());
+      set_roots.insert(set_roots.end(), local_roots[t].begin(),
+                       local_roots[t].end());
+      for (uint32_t sz : local_sizes[t])
+        offsets.push_back(offsets.back() + sz);
+    }
+  }
+
+  // greedy max coverage over the eligible nodes; covered[i] receives the
+  // number of sets newly covered by the i-th selected node
+  std::vector<int> select(int k, std::vector<size_t> &covered) const {
+    int n = g.num_nodes();
+    size_t sets = offsets.size() - 1;
+    std::vector<uint64_t> node_offsets(n + 1, 0);
+    for (int v : nodes)
+      node_offsets[v + 1]++;
+    for (int v = 0; v < n; ++v)
+      node_offsets[v + 1] += node_offsets[v];
+    std::vector<uint32_t> node_sets(nodes.size());
+    std::vector<uint64_t> fill(node_offsets.begin(), node_offsets.end() - 1);
+    for (size_t r = 0; r < sets; ++r)
+      for (uint64_t i = offsets[r]; i < offsets[r + 1]; ++i)
+        node_sets[fill[nodes[i]]++] = (uint32_t)r;
+
+    // degree: uncovered local sets per node, -1 once a node is out;
+    // total: the same summed over the ranks
+    std::vector<int64_t> degree(n, -1), total;
+    for (int v = 0; v < n; ++v)
+      if (g.has_value[v])
+        degree[v] = node_offsets[v + 1] - node_offsets[v];
+    std::vector<char> set_covered(sets, 0);
+
+    std::vector<int> seeds;
+    covered.clear();
+    for (int i = 0; i < k; ++i) {
+      const std::vector<int64_t> *count = &degree;
+      if (ranks > 1) {
+        total = degree;
+        for (int v = 0; v < n; ++v)
+          total[v] = std::max<int64_t>(total[v], 0);
+        Cluster::get().sum(total.data(), n);
+        for (int v = 0; v < n; ++v)
+          if (degree[v] < 0)
+            total[v] = -1;
+        count = &total;
+      }
+      int best = -1;
+      for (int v = 0; v < n; ++v)
+        if ((*count)[v] >= 0 && (best < 0 || (*count)[v] > (*count)[best]))
+          best = v;
+      if (best < 0)
+        break;
+      size_t newly = (*count)[best];
+      for (uint64_t j = node_offsets[best]; j < node_offsets[best + 1]; ++j) {
+        uint32_t r = node_sets[j];
+        if (set_covered[r])
+          continue;
+        set_covered[r] = 1;
+        for (uint64_t x = offsets[r]; x < offsets[r + 1]; ++x)
+          if (degree[nodes[x]] > 0)
+            degree[nodes[x]]--;
+      }
+      degree[best] = -1;
+      seeds.push_back(best);
+      covered.push_back(newly);
+    }
+    return seeds;
+  }
+
+  // What refresh() did with the sets of an index.
+  struct RefreshStats {
+    size_t loaded = 0;
+    size_t rewalked = 0;
+    size_t rerooted = 0;
+    int dirty_nodes = 0;
+    int affected_nodes = 0;
+  };
+
+  // Writes the sets with the names, weights and in-edge fingerprints of the
+  // graph they were sampled from.
+  void save(const std::string &filename) const {
+    uint64_t n = g.num_nodes();
+    std::vector<uint64_t> name_offsets(n + 1, 0);
+    for (uint64_t u = 0; u < n; ++u)
+      name_offsets[u + 1] = name_offsets[u] + g.name(u).size();
+    std::vector<uint64_t> prints = fingerprints();
+
+    IndexHeader h{};
+    std::memcpy(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    h.version = INDEX_VERSION;
+    h.byte_order = GraphSnapshot::BYTE_ORDER_MARK;
+    h.generation = generation;
+    h.seed = seed;
+    h.num_nodes = n;
+    h.num_sets = size();
+    h.num_entries = nodes.size();
+    h.names_bytes = name_offsets[n];
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+      throw std::runtime_error("Cannot open file " + filename);
+    uint64_t written = 0;
+    auto put = [&](const void *p, size_t bytes) {
+      out.write(static_cast<const char *>(p), bytes);
+      written += bytes;
+      static const char zeros[8] = {};
+      out.write(zeros, (8 - written % 8) % 8);
+      written += (8 - written % 8) % 8;
+    };
+    put(&h, sizeof(h));
+    put(g.node_values.data(), n * sizeof(double));
+    put(prints.data(), n * sizeof(uint64_t));
+    put(set_roots.data(), set_roots.size() * sizeof(int32_t));
+    put(offsets.data(), offsets.size() * sizeof(uint64_t));
+    put(nodes.data(), nodes.size() * sizeof(int32_t));
+    put(name_offsets.data(), name_offsets.size() * sizeof(uint64_t));
+    for (uint64_t u = 0; u < n; ++u)
+      out.write(g.name(u).data(), g.name(u).size());
+    out.flush();
+    if (!out)
+      throw std::runtime_error("Failed writing RR index " + filename);
+    std::cerr << "Wrote RR index " << filename << " (" << size() << " sets, "
+              << nodes.size() << " entries)" << std::endl;
+  }
+
+  // Replaces the sets with those of the index in filename, brought up to
+  // date with the current graph. Only the nodes that reach an edge or
+  // eligibility change can have been walked differently, so only sets
+  // rooted at one of them are walked again, with their old key. Weight
+  // changes move roots: a set keeps its root with probability
+  // min(1, q / p) and otherwise draws one from the residual max(0, q - p),
+  // which leaves every root distributed as q again.
+  RefreshStats refresh(const std::string &filename) {
+    MappedFile file(filename);
+    const char *base = file.data;
+    uint64_t pos = 0;
+    auto take = [&](uint64_t bytes) -> const char * {
+      if (pos + bytes > file.size)
+        throw std::runtime_error("Truncated RR index " + filename);
+      const char *p = base + pos;
+      pos += bytes + (8 - bytes % 8) % 8;
+      return p;
+    };
+
+    IndexHeader h;
+    std::memcpy(&h, take(sizeof(IndexHeader)), sizeof(IndexHeader));
+    if (std::memcmp(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+      throw std::runtime_error(filename + " is not an RR index");
+    if (h.byte_order != GraphSnapshot::BYTE_ORDER_MARK)
+      throw std::runtime_error("RR index " + filename +
+                               " was written on a different byte order");
+    if (h.version != INDEX_VERSION)
+      throw std::runtime_error("RR index " + filename + " has version " +
+                               std::to_string(h.version) + ", expected " +
+                               std::to_string(INDEX_VERSION));
+
+    uint64_t old_n = h.num_nodes, sets = h.num_sets;
+    auto old_values =
+        reinterpret_cast<const double *>(take(old_n * sizeof(double)));
+    auto old_prints =
+        reinterpret_cast<const uint64_t *>(take(old_n * sizeof(uint64_t)));
+    auto old_roots =
+        reinterpret_cast<const int32_t *>(take(sets * sizeof(int32_t)));
+    auto old_offsets = reinterpret_cast<const uint64_t *>(
+        take((sets + 1) * sizeof(uint64_t)));
+    auto old_nodes = reinterpret_cast<const int32_t *>(
+        take(h.num_entries * sizeof(int32_t)));
+    auto name_offsets = reinterpret_cast<const uint64_t *>(
+        take((old_n + 1) * sizeof(uint64_t)));
+    const char *names = take(h.names_bytes);
+
+    seed = h.seed;
+    generation = h.generation + 1;
+    total_sets = sets;
+    int n = g.num_nodes();
+    RefreshStats stats;
+    stats.loaded = sets;
+
+    std::vector<int> new_id(old_n), old_id(n, -1);
+    double old_weight = 0.0;
+    for (uint64_t o = 0; o < old_n; ++o) {
+      new_id[o] = g.find_id(std::string_view(
+          names + name_offsets[o], name_offsets[o + 1] - name_offsets[o]));
+      if (new_id[o] >= 0)
+        old_id[new_id[o]] = (int)o;
+      if (old_values[o] > 0.0)
+        old_weight += old_values[o];
+    }
+
+    // dirty: new nodes and nodes whose in-edges or eligibility changed;
+    // affected: everything they reach
+    std::vector<uint64_t> prints = fingerprints();
+    std::vector<char> affected(n, 0);
+    std::vector<int> queue;
+    for (int v = 0; v < n; ++v)
+      if (old_id[v] < 0 || old_prints[old_id[v]] != prints[v]) {
+        affected[v] = 1;
+        queue.push_back(v);
+      }
+    stats.dirty_nodes = (int)queue.size();
+    for (size_t head = 0; head < queue.size(); ++head) {
+      int u = queue[head];
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+        if (!affected[g.targets[e]]) {
+          affected[g.targets[e]] = 1;
+          queue.push_back(g.targets[e]);
+        }
+    }
+    stats.affected_nodes = (int)queue.size();
+
+    auto p = [&](int v) {
+      int o = old_id[v];
+      return o >= 0 && old_values[o] > 0.0 ? old_values[o] / old_weight : 0.0;
+    };
+    auto q = [&](int v) {
+      return g.node_values[v] > 0.0 ? g.node_values[v] / total_weight : 0.0;
+    };
+    std::vector<int> residual_roots;
+    std::vector<double> residual_cdf;
+    double residual = 0.0;
+    for (int v : roots)
+      if (q(v) > p(v)) {
+        residual += q(v) - p(v);
+        residual_roots.push_back(v);
+        residual_cdf.push_back(residual);
+      }
+
+    if (roots.empty() && sets > 0)
+      throw std::runtime_error("Cannot refresh RR index " + filename +
+                               ": no node has a positive value");
+    uint64_t refresh_key =
+        CounterRng::bits(CounterRng::bits(seed, UINT64_MAX - 1), generation);
+    int threads = omp_get_max_threads();
+    std::vector<std::vector<int>> local_nodes(threads);
+    std::vector<std::vector<uint32_t>> local_sizes(threads);
+    std::vector<std::vector<int>> local_roots(threads);
+    size_t rewalked = 0, rerooted = 0;
+#pragma omp parallel reduction(+ : rewalked, rerooted)
+    {
+      int tid = omp_get_thread_num();
+      std::vector<unsigned int> last_seen(n, 0u);
+      std::vector<int> walk_queue;
+      unsigned int token = 0;
+#pragma omp for schedule(static)
+      for (int64_t i = 0; i < (int64_t)sets; ++i) {
+        std::vector<int> &out = local_nodes[tid];
+        size_t before = out.size();
+        int root = new_id[old_roots[i]];
+        double old_p = old_values[old_roots[i]] / old_weight;
+        double new_q = root >= 0 ? q(root) : 0.0;
+        bool moved = false;
+        if (uniform(CounterRng::bits(refresh_key, 2 * i)) * old_p >= new_q &&
+            !residual_roots.empty()) {
+          double r = uniform(CounterRng::bits(refresh_key, 2 * i + 1));
+          size_t j = std::upper_bound(residual_cdf.begin(),
+                                      residual_cdf.end(), r * residual) -
+                     residual_cdf.begin();
+          root = residual_roots[std::min(j, residual_roots.size() - 1)];
+          moved = true;
+        }
+        // a deleted root with no residual left to move to (rounding only)
+        // draws its new root from the whole distribution
+        if (root < 0) {
+          root = sample_root(
+              uniform(CounterRng::bits(refresh_key, 2 * i + 1)));
+          moved = true;
+        }
+        bool stale = moved || affected[root];
+        for (uint64_t x = old_offsets[i]; x < old_offsets[i + 1] && !stale;
+             ++x) {
+          int v = new_id[old_nodes[x]];
+          if (v < 0 || !g.has_value[v])
+            stale = true;
+          else
+            out.push_back(v);
+        }
+        if (stale) {
+          out.resize(before);
+          walk(root, CounterRng::bits(seed, i), last_seen, token, walk_queue,
+               out);
+          rewalked++;
+          rerooted += moved;
+        }
+        local_roots[tid].push_back(root);
+        local_sizes[tid].push_back(out.size() - before);
+      }
+    }
+    stats.rewalked = rewalked;
+    stats.rerooted = rerooted;
+
+    offsets.assign(1, 0);
+    nodes.clear();
+    set_roots.clear();
+    for (int t = 0; t < threads; ++t) {
+      nodes.insert(nodes.end(), local_nodes[t].begin(), local_nodes[t].end());
+      set_roots.insert(set_roots.end(), local_roots[t].begin(),
+                       local_roots[t].end());
+      for (uint32_t sz : local_sizes[t])
+        offsets.push_back(offsets.back() + sz);
+    }
+    return stats;
+  }
+
+  uint64_t key_seed() const { return seed; }
+
+  double total_weight = 0.0;
+  std::vector<uint64_t> offsets{0};
+  std::vector<int> nodes;
+
+private:
+  static constexpr char INDEX_MAGIC[4] = {'W', 'M', 'R', 'R'};
+  static constexpr uint32_t INDEX_VERSION = 1;
+
+  // header | node_values | fingerprints | set roots | set offsets |
+  // set nodes | name offsets | name bytes, every section 8-byte aligned
+  struct IndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t generation;
+    uint64_t seed;
+    uint64_t num_nodes;
+    uint64_t num_sets;
+    uint64_t num_entries;
+    uint64_t names_bytes;
+  };
+
+  static double uniform(uint64_t bits) { return (bits >> 11) * 0x1.0p-53; }
+
+  // appends the eligible nodes that reach root in the world of set_key
+  void walk(int root, uint64_t set_key, std::vector<unsigned int> &last_seen,
+            unsigned int &token, std::vector<int> &queue,
+            std::vector<int> &out) const {
+    if (++token == 0u) {
+      token = 1;
+      std::fill(last_seen.begin(), last_seen.end(), 0u);
+    }
+    queue.assign(1, root);
+    last_seen[root] = token;
+    long long edges = 0;
+    for (size_t head = 0; head < queue.size(); ++head) {
+      int v = queue[head];
+      if (g.has_value[v])
+        out.push_back(v);
+      edges += in_offsets[v + 1] - in_offsets[v];
+      for (uint32_t e = in_offsets[v]; e < in_offsets[v + 1]; ++e) {
+        int w = in_sources[e];
+        if (last_seen[w] != token &&
+            edge_live(set_key, in_keys[e], in_thresholds[e])) {
+          last_seen[w] = token;
+          queue.push_back(w);
+        }
+      }
+    }
+    ThreadCounters &c = Profiler::get().local();
+    c.cascades++;
+    c.edge_visits += edges;
+    c.activations += queue.size();
+  }
+
+  // order-independent digest of the in-edges (source, threshold) and the
+  // eligibility of every node: a walk through v reads exactly these
+  std::vector<uint64_t> fingerprints() const {
+    int n = g.num_nodes();
+    std::vector<uint64_t> prints(n);
+#pragma omp parallel for schedule(static)
+    for (int v = 0; v < n; ++v) {
+      uint64_t h = g.has_value[v] ? 0x5DEECE66Dull : 0ull;
+      for (uint32_t e = in_offsets[v]; e < in_offsets[v + 1]; ++e)
+        h += splitmix64(in_keys[e] ^ ((uint64_t)in_thresholds[e] << 17));
+      prints[v] = h;
+    }
+    return prints;
+  }
+
+  int sample_root(double r) const {
+    size_t i = std::upper_bound(root_cdf.begin(), root_cdf.end(),
+                                r * total_weight) -
+               root_cdf.begin();
+    return roots[std::min(i, roots.size() - 1)];
+  }
+
+  const Graph &g;
+  std::vector<uint32_t> in_offsets;
+  std::vector<int> in_sources;
+  std::vector<uint32_t> in_thresholds;
+  std::vector<uint64_t> in_keys;
+  uint64_t seed;
+  int rank;
+  int ranks;
+  size_t total_sets = 0;
+  uint32_t generation = 0;
+  std::vector<int> roots;
+  std::vector<double> root_cdf;
+  std::vector<int> set_roots;
+};
+
+// IMM (Tang et al. 2015) with spreads measured in node_values instead of
+// node counts: total_weight takes the place of n in the sample size bounds.
+// With probability >= 1 - delta the result is a (1 - 1/e - epsilon)
+// approximation of the best weighted reach.
+//
+// With an index file, the sets stored there are refreshed against g and
+// reused, and the sets of this run are stored back.
+std::vector<int> imm_weighted_influence(const Graph &g, int k, double epsilon,
+                                        double delta, uint64_t seed,
+                                        SeedReporter &out,
+                                        const std::string &index = "") {
+  int n = g.num_nodes();
+  int eligible = 0;
+  for (int i = 0; i < n; ++i)
+    eligible += g.has_value[i] ? 1 : 0;
+  k = std::min(k, eligible);
+  ScopedPhase setup("IMM setup");
+  RRSets rr(g, seed);
+  double W = rr.total_weight;
+  if (k <= 0 || W <= 0.0) {
+    std::cerr << "Warning: no eligible node carries a positive value."
+              << std::endl;
+    return out.seeds();
+  }
+
+  double log_n = std::log(std::max(n, 2));
+  double ell = std::log(1.0 / delta) / log_n;
+  ell *= 1.0 + std::log(2.0) / log_n;
+  double log_cnk = std::lgamma(eligible + 1.0) - std::lgamma(k + 1.0) -
+                   std::lgamma(eligible - k + 1.0);
+
+  if (!index.empty() && std::ifstream(index).good()) {
+    auto start = std::chrono::steady_clock::now();
+    RRSets::RefreshStats stats = rr.refresh(index);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "Refreshed RR index " << index << " in " << elapsed.count()
+              << "s: " << stats.loaded << " sets, " << stats.rewalked
+              << " walked again (" << stats.rerooted << " for weight changes, "
+              << stats.dirty_nodes << " changed nodes reaching "
+              << stats.affected_nodes << "), seed " << rr.key_seed()
+              << std::endl;
+  }
+
+  setup.stop();
+
+  std::cout << "Sampling weighted RR sets (epsilon=" << epsilon
+            << ", delta=" << delta << ", total weight " << W << ")..."
+            << std::endl;
+
+  // sampling phase: find a lower bound on OPT
+  ScopedPhase sampling("IMM sampling");
+  double eps_p = std::sqrt(2.0) * epsilon;
+  double lambda_p = (2.0 + 2.0 / 3.0 * eps_p) *
+                    (log_cnk + ell * log_n + std::log(std::log2(n + 1.0))) *
+                    W / (eps_p * eps_p);
+  double lb = W / n;
+  std::vector<size_t> covered;
+  for (int i = 1; i < std::log2(n + 1.0); ++i) {
+    double x = W / std::pow(2.0, i);
+    rr.generate_until((size_t)std::ceil(lambda_p / x));
+    rr.select(k, covered);
+    size_t hit = 0;
+    for (size_t c : covered)
+      hit += c;
+    double estimate = W * hit / rr.size();
+    if (estimate >= (1.0 + eps_p) * x) {
+      lb = estimate / (1.0 + eps_p);
+      break;
+    }
+  }
+
+  sampling.stop();
+
+  // node selection phase
+  ScopedPhase selection("IMM selection");
+  double e = std::exp(1.0);
+  double alpha = std::sqrt(ell * log_n + std::log(2.0));
+  double beta =
+      std::sqrt((1.0 - 1.0 / e) * (log_cnk + ell * log_n + std::log(2.0)));
+  double lambda_star = 2.0 * W * std::pow((1.0 - 1.0 / e) * alpha + beta, 2) /
+                       (epsilon * epsilon);
+  rr.generate_until((size_t)std::ceil(lambda_star / lb));
+  int64_t entries = rr.nodes.size();
+  Cluster::get().sum(&entries, 1);
+  std::cout << "Using " << rr.size() << " RR sets (" << entries
+            << " entries, OPT lower bound " << lb << ")" << std::endl;
+
+  std::vector<int> order = rr.select(k, covered);
+  if (!index.empty())
+    rr.save(index);
+  double current_val = 0.0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    double marginal_gain = W * covered[i] / rr.size();
+    current_val += marginal_gain;
+    out.selected(order[i], marginal_gain, current_val);
+  }
+  return out.seeds();
+}
+
+// Live-edge worlds walked one instance at a time. Instance (v, i) is the
+// valued node v in world i, ranked Exp(1) / node_values[v], so the k
+// smallest ranks a node reaches form a bottom-k sketch of its weighted
+// reach over all worlds (Cohen et al. 2014). Edge e is live in world i iff
+// edge_live(world key i, e, threshold), so walks in either direction see
+// the same world.
+class RankedWorlds {
+public:
+  struct Instance {
+    double rank;
+    int node;
+    int world;
+  };
+
+  RankedWorlds(const Graph &g, int worlds, uint64_t seed)
+      : g(g), num_worlds(worlds) {
+    int n = g.num_nodes();
+    in_offsets.assign(n + 1, 0);
+    for (int u = 0; u < n; ++u)
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+        in_offsets[g.targets[e] + 1]++;
+    for (int v = 0; v < n; ++v)
+      in_offsets[v + 1] += in_offsets[v];
+    in_sources.resize(g.num_edges());
+    in_edges.resize(g.num_edges());
+    std::vector<uint32_t> fill(in_offsets.begin(), in_offsets.end() - 1);
+    for (int u = 0; u < n; ++u)
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+        uint32_t slot = fill[g.targets[e]]++;
+        in_sources[slot] = u;
+        in_edges[slot] = e;
+      }
+
+    for (int i = 0; i < worlds; ++i)
+      world_keys.push_back(CounterRng::bits(seed, i));
+    uint64_t rank_key = CounterRng::bits(seed, UINT64_MAX);
+    for (int v = 0; v < n; ++v)
+      if (g.node_values[v] > 0.0) {
+        dense_index.push_back(valued.size());
+        valued.push_back(v);
+      } else {
+        dense_index.push_back(-1);
+      }
+    size_t per_world = valued.size();
+    instances.resize(per_world * worlds);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < worlds; ++i)
+      for (size_t j = 0; j < per_world; ++j) {
+        int v = valued[j];
+        uint64_t bits =
+            CounterRng::bits(rank_key, (uint64_t)i * n + (uint64_t)v);
+        double u = ((bits >> 11) + 1) * 0x1.0p-53;
+        instances[(size_t)i * per_world + j] = {-std::log(u) /
+                                                    g.node_values[v],
+                                                v, i};
+      }
+    std::sort(instances.begin(), instances.end(),
+              [](const Instance &a, const Instance &b) {
+                if (a.rank != b.rank)
+                  return a.rank < b.rank;
+                return a.world != b.world ? a.world < b.world
+                                          : a.node < b.node;
+              });
+  }
+
+  int worlds() const { return num_worlds; }
+  size_t size() const { return instances.size(); }
+  const Instance &operator[](size_t i) const { return instances[i]; }
+
+  // dense id of instance (v, i), for per-instance flags
+  size_t id(int v, int world) const {
+    return (size_t)world * valued.size() + dense_index[v];
+  }
+  size_t ids() const { return valued.size() * num_worlds; }
+
+  // calls consume(i, reachers) for every instance i in [first, last) in
+  // order, reachers being the eligible nodes that reach it in its world;
+  // the walks run in parallel batches, consume runs on the calling thread
+  // and stops the scan by returning false
+  template <class Consume>
+  void reverse_reach(size_t first, size_t last, Consume consume) const {
+    reverse_reach(first, last,
+                  256 * (size_t)std::max(1, omp_get_max_threads()),
+                  [](int) { return false; }, consume);
+  }
+
+  // same, but walks neither enter nor report nodes for which prune(v)
+  // holds; prune is evaluated during the walks of a batch, so it sees the
+  // state consume left at the end of the previous batch
+  template <class Prune, class Consume>
+  void reverse_reach(size_t first, size_t last, size_t batch, Prune prune,
+                     Consume consume) const {
+    std::vector<std::vector<int>> reachers(batch);
+    // per-thread walk state, kept across batches
+    std::vector<TokenScratch> scratch(std::max(1, omp_get_max_threads()),
+                                      TokenScratch(g.num_nodes()));
+    for (size_t begin = first; begin < last; begin += batch) {
+      size_t count = std::min(batch, last - begin);
+#pragma omp parallel
+      {
+        TokenScratch &local = scratch[omp_get_thread_num()];
+        std::vector<unsigned int> &last_seen = local.last_seen;
+        int *queue = local.queue.data();
+        ThreadCounters &counters = Profiler::get().local();
+#pragma omp for schedule(dynamic, 16)
+        for (size_t j = 0; j < count; ++j) {
+          const Instance &inst = instances[begin + j];
+          uint64_t key = world_keys[inst.world];
+          std::vector<int> &out = reachers[j];
+          out.clear();
+          if (prune(inst.node))
+            continue;
+          unsigned int token = local.next_token();
+          size_t tail = 0;
+          queue[tail++] = inst.node;
+          last_seen[inst.node] = token;
+          for (size_t head = 0; head < tail; ++head) {
+            int v = queue[head];
+            if (g.has_value[v])
+              out.push_back(v);
+            counters.edge_visits += in_offsets[v + 1] - in_offsets[v];
+            for (uint32_t s = in_offsets[v]; s < in_offsets[v + 1]; ++s) {
+              int w = in_sources[s];
+              uint32_t e = in_edges[s];
+              if (last_seen[w] != token && !prune(w) &&
+                  edge_live(key, e, g.thresholds[e])) {
+                last_seen[w] = token;
+                queue[tail++] = w;
+              }
+            }
+          }
+          counters.cascades++;
+          counters.activations += tail;
+        }
+      }
+      for (size_t j = 0; j < count; ++j)
+        if (!consume(begin + j, reachers[j]))
+          return;
+    }
+  }
+
+  // valued nodes reached from node in one world, not entering nodes for
+  // which stop(v) holds
+  template <class Stop>
+  void forward_reach(int node, int world, std::vector<int> &reached,
+                     std::vector<unsigned int> &last_seen, unsigned int token,
+                     Stop stop) const {
+    uint64_t key = world_keys[world];
+    std::vector<int> queue(1, node);
+    last_seen[node] = token;
+    reached.clear();
+    long long edges = 0;
+    for (size_t head = 0; head < queue.size(); ++head) {
+      int u = queue[head];
+      if (dense_index[u] >= 0)
+        reached.push_back(u);
+      edges += g.out_degree(u);
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+        int v = g.targets[e];
+        if (last_seen[v] != token && !stop(v) &&
+            edge_live(key, e, g.thresholds[e])) {
+          last_seen[v] = token;
+          queue.push_back(v);
+        }
+      }
+    }
+    ThreadCounters &c = Profiler::get().local();
+    c.cascades++;
+    c.edge_visits += edges;
+    c.activations += queue.size();
+  }
+
+private:
+  const Graph &g;
+  int num_worlds;
+  std::vector<uint32_t> in_offsets;
+  std::vector<int> in_sources;
+  std::vector<uint32_t> in_edges;
+  std::vector<uint64_t> world_keys;
+  std::vector<int> valued;
+  std::vector<int> dense_index;
+  std::vector<Instance> instances;
+};
+
+// Combined bottom-k reachability sketches of every eligible node, an
+// oracle for the weighted reach of a seed set: the sketch of a set is the
+// bottom-k of the union of its members' sketches, so spread and marginal
+// gain queries cost O(k * |S|) once the index is built.
+//
+// Instances are added in rank order and a walk stops at nodes whose sketch
+// is already full, as in the pruned construction of Cohen et al. That cut
+// the build over 1000 worlds of the npm graph from 1.2e9 to 6e7 edge
+// visits. A node that reaches an instance only through a full node in that
+// world misses its rank, so its sketch can hold larger ranks than the
+// exact one: most packages keep their exact estimate, a few come out up
+// to ~15% low. On top of the 1/sqrt(k - 2) error of the estimate itself,
+// a marginal gain can then exceed the package's own reach, so gain()
+// clamps it.
+class ReachSketches {
+public:
+  struct Entry {
+    double rank;
+    int node;
+    bool operator<(const Entry &o) const {
+      return rank != o.rank ? rank < o.rank : node < o.node;
+    }
+    bool operator==(const Entry &o) const {
+      return rank == o.rank && node == o.node;
+    }
+  };
+  using Sketch = std::vector<Entry>;
+
+  ReachSketches(const Graph &g, const RankedWorlds &worlds, int k)
+      : g(g), k(k), worlds(worlds.worlds()), sketches(g.num_nodes()) {
+    // a fixed batch keeps which walks see which full sketches, and so the
+    // sketches themselves, independent of the thread count
+    worlds.reverse_reach(
+        0, worlds.size(), 4096,
+        [&](int u) { return (int)sketches[u].size() >= k; },
+        [&](size_t i, const std::vector<int> &r) {
+          const RankedWorlds::Instance &inst = worlds[i];
+          for (int u : r)
+            if ((int)sketches[u].size() < k)
+              sketches[u].push_back({inst.rank, inst.node});
+          return true;
+        });
+  }
+
+  const Sketch &of(int node) const { return sketches[node]; }
+
+  Sketch merge(const Sketch &a, const Sketch &b) const {
+    Sketch out;
+    out.reserve(k);
+    size_t i = 0, j = 0;
+    while ((int)out.size() < k && (i < a.size() || j < b.size())) {
+      Entry next;
+      if (j == b.size() || (i < a.size() && a[i] < b[j]))
+        next = a[i++];
+      else
+        next = b[j++];
+      if (out.empty() || !(out.back() == next))
+        out.push_back(next);
+    }
+    return out;
+  }
+
+  // average weighted reach per world; exact while the sketch is not full,
+  // otherwise the inverse-probability estimate over the first k - 1 entries
+  double estimate(const Sketch &s) const {
+    double total = 0.0;
+    if ((int)s.size() < k) {
+      for (const Entry &e : s)
+        total += g.node_values[e.node];
+    } else {
+      double tau = s[k - 1].rank;
+      for (int i = 0; i < k - 1; ++i) {
+        double w = g.node_values[s[i].node];
+        total += w / -std::expm1(-w * tau);
+      }
+    }
+    return total / worlds;
+  }
+
+  // what node adds to a set whose merged sketch with node estimates
+  // merged; the difference of two noisy estimates, kept within [0, reach
+  // of node alone]
+  double gain(double merged, double total, int node) const {
+    return std::max(0.0,
+                    std::min(merged - total, estimate(sketches[node])));
+  }
+
+private:
+  const Graph &g;
+  int k;
+  int worlds;
+  std::vector<Sketch> sketches;
+};
+
+// Answers "what is the weighted reach of X, and what does adding Y add"
+// for each package of names in turn, from one sketch index.
+void answer_sketch_queries(const Graph &g, const std::vector<std::string> &names,
+                           int worlds, int sketch_k, uint64_t seed) {
+  auto start = std::chrono::steady_clock::now();
+  ScopedPhase build("sketch build");
+  RankedWorlds ranked(g, worlds, seed);
+  ReachSketches sketches(g, ranked, sketch_k);
+  build.stop();
+  std::chrono::duration<double> built =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Built bottom-" << sketch_k << " sketches over " << worlds
+            << " worlds in " << built.count() << "s" << std::endl;
+
+  ReachSketches::Sketch combined;
+  double total = 0.0;
+  for (const std::string &name : names) {
+    int u = g.find_id(name);
+    if (u < 0 || !g.has_value[u]) {
+      std::cout << "Query " << name << " | not an eligible package"
+                << std::endl;
+      continue;
+    }
+    auto asked = std::chrono::steady_clock::now();
+    double reach = sketches.estimate(sketches.of(u));
+    ReachSketches::Sketch next = sketches.merge(combined, sketches.of(u));
+    double next_total = sketches.estimate(next);
+    std::chrono::duration<double, std::micro> took =
+        std::chrono::steady_clock::now() - asked;
+    std::cout << "Query " << name << " | Weighted Reach: " << reach
+              << " | Marginal Gain: " << sketches.gain(next_total, total, u)
+              << " | Total Weighted Reach: " << next_total << " ("
+              << took.count() << " us)" << std::endl;
+    combined.swap(next);
+    total = next_total;
+  }
+}
+
+// Long-running query mode: the graph and one sketch index stay resident
+// and clients talk to it over a Unix socket, one request per line and one
+// JSON object per answer line:
+//   spread <pkg,...>           weighted reach of the set
+//   gain <pkg,...> <pkg,...>   what each package of the second list adds
+//                              to the first set
+//   top <n> [pkg,...]          the next n seeds, greedily, after the set
+//   quit                       closes the connection
+//   shutdown                   stops the server
+// "-" stands for the empty set. Answers only read the index, so every
+// thread of the team accepts and serves its own connections.
+class QueryServer {
+public:
+  QueryServer(const Graph &g, const ReachSketches &sketches)
+      : g(g), sketches(sketches) {
+    for (int v = 0; v < g.num_nodes(); ++v)
+      if (g.has_value[v])
+        by_reach.push_back({sketches.estimate(sketches.of(v)), v});
+    std::sort(by_reach.begin(), by_reach.end(),
+              [](const std::pair<double, int> &a,
+                 const std::pair<double, int> &b) {
+                return a.first != b.first ? a.first > b.first
+                                          : a.second < b.second;
+              });
+  }
+
+  // answer to one request line; sets close when the connection should
+  // end, and stop when the whole server should
+  std::string answer(const std::string &line, bool &close,
+                     bool &stop) const {
+    auto asked = std::chrono::steady_clock::now();
+    std::istringstream in(line);
+    std::string command, first, second;
+    in >> command >> first >> second;
+    std::ostringstream out;
+    out << "{";
+    if (command == "quit" || command == "shutdown") {
+      close = true;
+      stop = command == "shutdown";
+      out << "\"bye\":true";
+    } else if (command == "spread" && !first.empty()) {
+      Set set = parse_set(first);
+      out << "\"spread\":" << set.total << ",\"seeds\":";
+      names(out, set.nodes);
+      unknown(out, set);
+    } else if (command == "gain" && !first.empty() && !second.empty()) {
+      Set set = parse_set(first), candidates = parse_set(second);
+      out << "\"spread\":" << set.total << ",\"gains\":[";
+      for (size_t i = 0; i < candidates.nodes.size(); ++i) {
+        int v = candidates.nodes[i];
+        out << (i ? "," : "") << "{\"package\":\""
+            << SeedReporter::json_string(g.name(v)) << "\",\"gain\":"
+            << gain(set, v) << "}";
+      }
+      out << "]";
+      unknown(out, set);
+      unknown(out, candidates, "unknown_candidates");
+    } else if (command == "top" && !first.empty() &&
+               first.find_first_not_of("0123456789") == std::string::npos &&
+               first.size() < 7) {
+      Set set = parse_set(second.empty() ? "-" : second);
+      double base = set.total;
+      std::vector<std::pair<int, double>> picked = top(set, std::stoi(first));
+      out << "\"spread\":" << base << ",\"seeds\":[";
+      for (size_t i = 0; i < picked.size(); ++i) {
+        base += picked[i].second;
+        out << (i ? "," : "") << "{\"package\":\""
+            << SeedReporter::json_string(g.name(picked[i].first))
+            << "\",\"marginal_gain\":" << picked[i].second
+            << ",\"total_weighted_reach\":" << base << "}";
+      }
+      out << "]";
+      unknown(out, set);
+    } else {
+      out << "\"error\":\"expected spread <pkgs>, gain <pkgs> <pkgs>, "
+             "top <n> [pkgs], quit or shutdown\"";
+    }
+    std::chrono::duration<double, std::micro> took =
+        std::chrono::steady_clock::now() - asked;
+    out << ",\"us\":" << took.count() << "}\n";
+    return out.str();
+  }
+
+  // whether path is a socket left by an earlier server, which serve()
+  // replaces; throws if anything else is there
+  static bool stale_socket(const std::string &path) {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0)
+      return false;
+    if (!S_ISSOCK(st.st_mode))
+      throw std::runtime_error("Cannot serve on " + path +
+                               ": it exists and is not a socket");
+    return true;
+  }
+
+  // serves path until a client sends shutdown
+  void serve(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+      throw std::runtime_error("Socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      throw std::runtime_error("Cannot create socket");
+    if (stale_socket(path))
+      ::unlink(path.c_str());
+    if (::bind(fd, (const sockaddr *)&addr, sizeof(addr)) != 0 ||
+        ::listen(fd, 64) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot listen on " + path + ": " +
+                               std::strerror(errno));
+    }
+    int workers = std::max(1, omp_get_max_threads());
+    std::cout << "Serving queries on " << path << " with " << workers
+              << " threads" << std::endl;
+
+    std::atomic<bool> stopping{false};
+#pragma omp parallel num_threads(workers)
+    while (!stopping) {
+      int client = ::accept(fd, nullptr, nullptr);
+      if (client < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      if (converse(client, stopping)) {
+        stopping = true;
+        // wakes up the threads blocked in accept
+        ::shutdown(fd, SHUT_RDWR);
+      }
+      ::close(client);
+    }
+    ::close(fd);
+    ::unlink(path.c_str());
+    std::cout << "Query server stopped" << std::endl;
+  }
+
+private:
+  struct Set {
+    std::vector<int> nodes;
+    std::vector<std::string> unknown;
+    ReachSketches::Sketch sketch;
+    double total = 0.0;
+  };
+
+  Set parse_set(const std::string &list) const {
+    Set set;
+    size_t begin = 0;
+    while (list != "-" && begin <= list.size()) {
+      size_t end = std::min(list.find(',', begin), list.size());
+      std::string name = list.substr(begin, end - begin);
+      begin = end + 1;
+      if (name.empty())
+        continue;
+      int u = g.find_id(name);
+      if (u < 0 || !g.has_value[u])
+        set.unknown.push_back(name);
+      else if (std::find(set.nodes.begin(), set.nodes.end(), u) ==
+               set.nodes.end())
+        set.nodes.push_back(u);
+    }
+    for (int u : set.nodes)
+      set.sketch = sketches.merge(set.sketch, sketches.of(u));
+    set.total = sketches.estimate(set.sketch);
+    return set;
+  }
+
+  double gain(const Set &set, int v) const {
+    return sketches.gain(
+        sketches.estimate(sketches.merge(set.sketch, sketches.of(v))),
+        set.total, v);
+  }
+
+  // Lazy greedy continuation of set. A gain is only current for the seeds
+  // it was computed against, and nodes not looked at yet are bounded by
+  // their own reach, so a request usually evaluates a few hundred nodes.
+  std::vector<std::pair<int, double>> top(Set set, int count) const {
+    struct Candidate {
+      double gain;
+      int node;
+      int round;
+      bool operator<(const Candidate &o) const {
+        return gain != o.gain ? gain < o.gain : node > o.node;
+      }
+    };
+    std::priority_queue<Candidate> heap;
+    std::vector<std::pair<int, double>> picked;
+    auto taken = [&](int v) {
+      return std::find(set.nodes.begin(), set.nodes.end(), v) !=
+             set.nodes.end();
+    };
+    size_t next = 0;
+    for (int round = 0; round < count; ++round) {
+      while (true) {
+        while (next < by_reach.size() && taken(by_reach[next].second))
+          next++;
+        double bound =
+            next < by_reach.size() ? by_reach[next].first : -HUGE_VAL;
+        if (!heap.empty() && heap.top().gain >= bound) {
+          Candidate c = heap.top();
+          heap.pop();
+          if (c.round == round) {
+            picked.push_back({c.node, c.gain});
+            set.nodes.push_back(c.node);
+            set.sketch = sketches.merge(set.sketch, sketches.of(c.node));
+            set.total = sketches.estimate(set.sketch);
+            break;
+          }
+          heap.push({gain(set, c.node), c.node, round});
+        } else if (next < by_reach.size()) {
+          int v = by_reach[next++].second;
+          heap.push({gain(set, v), v, round});
+        } else {
+          return picked;
+        }
+      }
+    }
+    return picked;
+  }
+
+  void names(std::ostringstream &out, const std::vector<int> &nodes) const {
+    out << "[";
+    for (size_t i = 0; i < nodes.size(); ++i)
+      out << (i ? "," : "") << "\""
+          << SeedReporter::json_string(g.name(nodes[i])) << "\"";
+    out << "]";
+  }
+
+  void unknown(std::ostringstream &out, const Set &set,
+               const char *key = "unknown") const {
+    if (set.unknown.empty())
+      return;
+    out << ",\"" << key << "\":[";
+    for (size_t i = 0; i < set.unknown.size(); ++i)
+      out << (i ? "," : "") << "\""
+          << SeedReporter::json_string(set.unknown[i]) << "\"";
+    out << "]";
+  }
+
+  // answers the lines of one connection until it closes; true if the
+  // client asked for a shutdown
+  bool converse(int client, const std::atomic<bool> &stopping) const {
+    std::string buffer;
+    char chunk[4096];
+    bool close = false, stop = false;
+    while (!close && !stopping) {
+      // wake up now and then to notice a shutdown from another client
+      pollfd p{client, POLLIN, 0};
+      int ready = ::poll(&p, 1, 200);
+      if (ready < 0 && errno != EINTR)
+        break;
+      if (ready <= 0)
+        continue;
+      ssize_t got = ::recv(client, chunk, sizeof(chunk), 0);
+      if (got <= 0)
+        break;
+      buffer.append(chunk, got);
+      size_t newline;
+      while (!close && (newline = buffer.find('\n')) != std::string::npos) {
+        std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r')
+          line.pop_back();
+        if (line.empty())
+          continue;
+        std::string reply = answer(line, close, stop);
+        for (size_t sent = 0; sent < reply.size();) {
+          ssize_t n = ::send(client, reply.data() + sent,
+                             reply.size() - sent, MSG_NOSIGNAL);
+          if (n <= 0)
+            return stop;
+          sent += n;
+        }
+      }
+    }
+    return stop;
+  }
+
+  const Graph &g;
+  const ReachSketches &sketches;
+  // eligible nodes by their own estimated reach, largest first
+  std::vector<std::pair<double, int>> by_reach;
+};
+
+// builds the sketch index once and serves queries on path
+void serve_sketch_queries(const Graph &g, const std::string &path,
+                          int worlds, int sketch_k, uint64_t seed) {
+  // before the build, so a mistyped path fails right away
+  QueryServer::stale_socket(path);
+  auto start = std::chrono::steady_clock::now();
+  ScopedPhase build("sketch build");
+  RankedWorlds ranked(g, worlds, seed);
+  ReachSketches sketches(g, ranked, sketch_k);
+  QueryServer server(g, sketches);
+  build.stop();
+  std::chrono::duration<double> built =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Built bottom-" << sketch_k << " sketches over " << worlds
+            << " worlds in " << built.count() << "s" << std::endl;
+  ScopedPhase serving("serve");
+  server.serve(path);
+}
+
+// SKIM (Cohen et al. 2014) over weighted instances: sketches are grown in
+// rank order and the first eligible node to collect k instances has the
+// largest estimated reach, so it is selected; the instances it covers are
+// then removed from every sketch they entered, and the scan goes on. If
+// the instances run out first, the residual reaches are exact and the
+// remaining seeds are taken greedily from them. Gains are reported exactly
+// over the sampled worlds.
+std::vector<int> skim_weighted_influence(const Graph &g, int k, int worlds,
+                                         int sketch_k, uint64_t seed,
+                                         SeedReporter &out) {
+  int n = g.num_nodes();
+  ScopedPhase ranking("SKIM ranking");
+  RankedWorlds ranked(g, worlds, seed);
+  ranking.stop();
+  ScopedPhase scan("SKIM scan");
+  std::cout << "Ranking " << ranked.size() << " weighted instances over "
+            << worlds << " worlds (bottom-" << sketch_k << " sketches)..."
+            << std::endl;
+
+  std::vector<int> count(n, -1);
+  std::vector<int64_t> weight(n, 0);
+  for (int v = 0; v < n; ++v)
+    if (g.has_value[v])
+      count[v] = 0;
+  std::vector<char> covered(ranked.ids(), 0);
+  // processed instances and the eligible nodes they were counted for
+  std::vector<int64_t> slot(ranked.ids(), -1);
+  std::vector<uint64_t> slot_offsets{0};
+  std::vector<int> slot_nodes;
+
+  std::vector<unsigned int> last_seen(n, 0u);
+  unsigned int token = 0;
+  std::vector<int> reached;
+  double current_val = 0.0;
+  auto select = [&](int u) {
+    int64_t gain = 0;
+    for (int i = 0; i < worlds; ++i) {
+      ranked.forward_reach(u, i, reached, last_seen, ++token, [&](int v) {
+        return g.node_values[v] > 0.0 && covered[ranked.id(v, i)];
+      });
+      for (int x : reached) {
+        size_t id = ranked.id(x, i);
+        if (covered[id])
+          continue;
+        covered[id] = 1;
+        gain += g.fixed_values[x];
+        if (slot[id] < 0)
+          continue;
+        for (uint64_t j = slot_offsets[slot[id]];
+             j < slot_offsets[slot[id] + 1]; ++j) {
+          count[slot_nodes[j]]--;
+          weight[slot_nodes[j]] -= g.fixed_values[x];
+        }
+      }
+    }
+    count[u] = -1;
+    double marginal_gain = g.from_fixed(gain) / worlds;
+    current_val += marginal_gain;
+    out.selected(u, marginal_gain, current_val);
+  };
+
+  if (k > 0)
+    ranked.reverse_reach(
+        0, ranked.size(), [&](size_t i, const std::vector<int> &r) {
+          const RankedWorlds::Instance &inst = ranked[i];
+          size_t id = ranked.id(inst.node, inst.world);
+          if (covered[id])
+            return true;
+          slot[id] = (int64_t)slot_offsets.size() - 1;
+          int full = -1;
+          for (int u : r) {
+            if (count[u] < 0)
+              continue;
+            slot_nodes.push_back(u);
+            count[u]++;
+            weight[u] += g.fixed_values[inst.node];
+            if (count[u] >= sketch_k && (full < 0 || u < full))
+              full = u;
+          }
+          slot_offsets.push_back(slot_nodes.size());
+          if (full >= 0)
+            select(full);
+          return (int)out.seeds().size() < k;
+        });
+
+  while ((int)out.seeds().size() < k) {
+    int best = -1;
+    for (int v = 0; v < n; ++v)
+      if (count[v] >= 0 && weight[v] > 0 && (best < 0 || weight[v] > weight[best]))
+        best = v;
+    if (best < 0) {
+      std::cerr << "Warning: no instance left to cover before selecting k="
+                << k << " seeds. Selected " << out.seeds().size() << " seeds."
+                << std::endl;
+      break;
+    }
+    select(best);
+  }
+  return out.seeds();
+}
+
+// Maximum influence in-arborescences (Chen, Wang and Wang 2010). For every
+// valued node t the tree holds the nodes whose most probable path to t has
+// probability at least theta (and at most max_depth hops when set), each
+// linked to its successor on that path. Entries are stored per tree in
+// settle order, root first, so a parent always precedes its children.
+struct Arborescences {
+  std::vector<uint32_t> offsets{0};
+  std::vector<int> root;
+  std::vector<int> node;
+  // local index of the successor towards the root, -1 for the root
+  std::vector<int> parent;
+  // probability of the edge from node to its parent
+  std::vector<float> prob;
+
+  int size() const { return (int)root.size(); }
+};
+
+// one tree per node with is_root set; the trees do not depend on node
+// values, so jobs weighting the same graph differently can share them
+Arborescences build_arborescences(const Graph &g, double theta, int max_depth,
+                                  const std::vector<char> &is_root) {
+  int n = g.num_nodes();
+  std::vector<uint32_t> in_offsets(n + 1, 0);
+  for (int u = 0; u < n; ++u)
+    for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e)
+      in_offsets[g.targets[e] + 1]++;
+  for (int v = 0; v < n; ++v)
+    in_offsets[v + 1] += in_offsets[v];
+  std::vector<int> in_sources(g.num_edges());
+  std::vector<float> in_probs(g.num_edges());
+  {
+    std::vector<uint32_t> fill(in_offsets.begin(), in_offsets.end() - 1);
+    for (int u = 0; u < n; ++u)
+      for (uint32_t e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+        uint32_t slot = fill[g.targets[e]]++;
+        in_sources[slot] = u;
+        in_probs[slot] = g.probabilities[e];
+      }
+  }
+  std::vector<int> roots;
+  for (int v = 0; v < n; ++v)
+    if (is_root[v])
+      roots.push_back(v);
+
+  // contiguous root ranges per thread, concatenated in thread order, so
+  // the layout does not depend on the thread count
+  int threads = std::max(1, omp_get_max_threads());
+  std::vector<Arborescences> parts(threads);
+#pragma omp parallel num_threads(threads)
+  {
+    int tid = omp_get_thread_num();
+    size_t begin = roots.size() * tid / threads;
+    size_t end = roots.size() * (tid + 1) / threads;
+    Arborescences &part = parts[tid];
+    std::vector<double> best(n, 0.0);
+    std::vector<int> local(n, -1), hops(n, 0), via(n, -1), touched;
+    std::vector<float> via_prob(n, 0.0f);
+    // max-heap on path probability, ties to the smaller id
+    using Item = std::pair<double, int>;
+    auto worse = [](const Item &a, const Item &b) {
+      return a.first != b.first ? a.first < b.first : a.second > b.second;
+    };
+    std::priority_queue<Item, std::vector<Item>, decltype(worse)> heap(worse);
+    long long edges = 0;
+    for (size_t r = begin; r < end; ++r) {
+      int t = roots[r];
+      uint32_t base = (uint32_t)part.node.size();
+      best[t] = 1.0;
+      hops[t] = 0;
+      touched.push_back(t);
+      heap.push({1.0, t});
+      while (!heap.empty()) {
+        auto [pp, w] = heap.top();
+        heap.pop();
+        if (local[w] >= 0 || pp < best[w])
+          continue;
+        local[w] = int(part.node.size() - base);
+        part.node.push_back(w);
+        part.parent.push_back(via[w] < 0 ? -1 : local[via[w]]);
+        part.prob.push_back(via_prob[w]);
+        if (max_depth > 0 && hops[w] >= max_depth)
+          continue;
+        edges += in_offsets[w + 1] - in_offsets[w];
+        for (uint32_t e = in_offsets[w]; e < in_offsets[w + 1]; ++e) {
+          int u = in_sources[e];
+          double q = pp * in_probs[e];
+          if (local[u] >= 0 || q < theta || q <= best[u])
+            continue;
+          if (best[u] == 0.0)
+            touched.push_back(u);
+          best[u] = q;
+          hops[u] = hops[w] + 1;
+          via[u] = w;
+          via_prob[u] = in_probs[e];
+          heap.push({q, u});
+        }
+      }
+      for (int u : touched) {
+        best[u] = 0.0;
+        local[u] = -1;
+        hops[u] = 0;
+        via[u] = -1;
+        via_prob[u] = 0.0f;
+      }
+      touched.clear();
+      part.root.push_back(t);
+      part.offsets.push_back((uint32_t)part.node.size());
+    }
+    ThreadCounters &c = Profiler::get().local();
+    c.cascades += end - begin;
+    c.edge_visits += edges;
+  }
+
+  Arborescences trees = std::move(parts[0]);
+  for (int tid = 1; tid < threads; ++tid) {
+    Arborescences &part = parts[tid];
+    uint32_t shift = (uint32_t)trees.node.size();
+    for (size_t i = 1; i < part.offsets.size(); ++i)
+      trees.offsets.push_back(part.offsets[i] + shift);
+    trees.root.insert(trees.root.end(), part.root.begin(), part.root.end());
+    trees.node.insert(trees.node.end(), part.node.begin(), part.node.end());
+    trees.parent.insert(trees.parent.end(), part.parent.begin(),
+                        part.parent.end());
+    trees.prob.insert(trees.prob.end(), part.prob.begin(), part.prob.end());
+    part = Arborescences();
+  }
+  std::cout << "Built " << trees.size() << " influence arborescences with "
+            << trees.node.size() << " entries (theta " << theta << ")..."
+            << std::endl;
+  return trees;
+}
+
+// Greedy seed selection on the MIA model: the spread of S is the sum over
+// trees of val(root) * ap(root), with activation probabilities ap computed
+// exactly inside each tree. inc[u] holds the marginal gain of u, kept up to
+// date through the linear coefficients alpha(root, u) of each tree, and a
+// new seed only touches the trees that contain it. No sampling, so the
+// result depends on the graph alone. Trees rooted at nodes without value
+// contribute nothing.
+std::vector<int> mia_weighted_influence(const Graph &g, int k,
+                                        const Arborescences &trees,
+                                        SeedReporter &out) {
+  int n = g.num_nodes();
+  ScopedPhase setup("MIA setup");
+  size_t entries = trees.node.size();
+
+  // trees containing each node, as entry indices
+  std::vector<uint32_t> member_offsets(n + 1, 0);
+  std::vector<int> tree_of(entries);
+  for (int t = 0; t < trees.size(); ++t)
+    for (uint32_t i = trees.offsets[t]; i < trees.offsets[t + 1]; ++i) {
+      tree_of[i] = t;
+      member_offsets[trees.node[i] + 1]++;
+    }
+  for (int u = 0; u < n; ++u)
+    member_offsets[u + 1] += member_offsets[u];
+  std::vector<uint32_t> members(entries);
+  {
+    std::vector<uint32_t> fill(member_offsets.begin(),
+                               member_offsets.end() - 1);
+    for (uint32_t i = 0; i < entries; ++i)
+      members[fill[trees.node[i]]++] = i;
+  }
+
+  std::vector<char> is_seed(n, 0);
+  std::vector<double> ap(entries, 0.0), alpha(entries, 0.0);
+  // per-entry product of (1 - ap * p) over the children, with zero factors
+  // counted apart so a sibling product never divides by zero
+  std::vector<double> prod(entries, 1.0);
+  std::vector<int> zeros(entries, 0);
+  auto evaluate = [&](int t) {
+    if (g.node_values[trees.root[t]] == 0.0)
+      return;
+    uint32_t b = trees.offsets[t], e = trees.offsets[t + 1];
+    for (uint32_t i = b; i < e; ++i) {
+      prod[i] = 1.0;
+      zeros[i] = 0;
+    }
+    for (uint32_t i = e; i-- > b;) {
+      ap[i] = is_seed[trees.node[i]] ? 1.0 : (zeros[i] ? 1.0 : 1.0 - prod[i]);
+      if (trees.parent[i] < 0)
+        continue;
+      uint32_t w = b + trees.parent[i];
+      double f = 1.0 - ap[i] * trees.prob[i];
+      if (f == 0.0)
+        zeros[w]++;
+      else
+        prod[w] *= f;
+    }
+    alpha[b] = 1.0;
+    for (uint32_t i = b + 1; i < e; ++i) {
+      uint32_t w = b + trees.parent[i];
+      if (is_seed[trees.node[w]]) {
+        alpha[i] = 0.0;
+        continue;
+      }
+      double f = 1.0 - ap[i] * trees.prob[i];
+      double siblings = f == 0.0 ? (zeros[w] > 1 ? 0.0 : prod[w])
+                                 : (zeros[w] > 0 ? 0.0 : prod[w] / f);
+      alpha[i] = alpha[w] * trees.prob[i] * siblings;
+    }
+  };
+  std::vector<double> inc(n, 0.0);
+  auto contribute = [&](int t, double sign) {
+    double value = g.node_values[trees.root[t]];
+    if (value == 0.0)
+      return;
+    for (uint32_t i = trees.offsets[t]; i < trees.offsets[t + 1]; ++i)
+      if (!is_seed[trees.node[i]])
+        inc[trees.node[i]] += sign * value * alpha[i] * (1.0 - ap[i]);
+  };
+
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int t = 0; t < trees.size(); ++t)
+    evaluate(t);
+  for (int t = 0; t < trees.size(); ++t)
+    contribute(t, 1.0);
+  setup.stop();
+
+  ScopedPhase selection("MIA selection");
+  double current_val = 0.0;
+  while ((int)out.seeds().size() < k) {
+    int best = -1;
+    for (int u = 0; u < n; ++u)
+      if (g.has_value[u] && !is_seed[u] &&
+          (best < 0 || inc[u] > inc[best]))
+        best = u;
+    if (best < 0) {
+      std::cerr << "Warning: no candidate left before selecting k=" << k
+                << " seeds. Selected " << out.seeds().size() << " seeds."
+                << std::endl;
+      break;
+    }
+    double gain = inc[best];
+    for (uint32_t j = member_offsets[best]; j < member_offsets[best + 1]; ++j)
+      contribute(tree_of[members[j]], -1.0);
+    is_seed[best] = 1;
+    for (uint32_t j = member_offsets[best]; j < member_offsets[best + 1]; ++j) {
+      int t = tree_of[members[j]];
+      evaluate(t);
+      contribute(t, 1.0);
+    }
+    Profiler::get().local().evaluations +=
+        member_offsets[best + 1] - member_offsets[best];
+    current_val += gain;
+    out.selected(best, gain, current_val);
+  }
+  return out.seeds();
+}
+
+// Command line front end; bench/ builds the library part with
+// INFLUENCE_NO_MAIN.
+#ifndef INFLUENCE_NO_MAIN
+// one seed selection over one attribute of the shared graph
+struct Job {
+  std::string attribute;
+  int k;
+};
+
+struct Options {
+  std::string input;
+  int k = 0;
+  std::vector<Job> jobs;
+  int mc_rounds = DEFAULT_MC_ROUNDS;
+  std::string write_snapshot;
+  std::string edges_csv;
+  long long min_avg_daily = 0;
+  bool reverse = false;
+  std::string engine = "celf";
+  double epsilon = 0.1;
+  double delta = 0.0;
+  bool has_seed = false;
+  uint64_t seed = 0;
+  int sketch_k = 64;
+  std::vector<std::string> query;
+  std::string serve;
+  std::string rr_index;
+  std::string stream;
+  std::string profile_json;
+  std::string edge_model;
+  double min_edge_prob = 0.0;
+  int max_depth = 0;
+  double min_path_prob = 1.0 / 320.0;
+  bool gpu = false;
+  double adaptive = 0.0;
+  std::string reorder;
+  std::string checkpoint;
+  std::string resume;
+  int extend_k = 0;
+};
+
+static void print_usage(const char *prog) {
+  std::cerr << "Usage: " << prog
+            << " <gexf_file|wmig_file|nodes_csv> <k> <attribute_name>"
+               " [mc_rounds] [options]\n"
+               "attribute_name may list several jobs, attr[:k][,attr[:k]...],"
+               " run one after\n"
+               "the other on a single load of the graph.\n"
+               "Options:\n"
+               "  --write-snapshot <file>  save the loaded graph as .wmig\n"
+               "  --edges <csv>            dependency CSV, required with a"
+               " nodes CSV input\n"
+               "  --min_avg_daily <n>      CSV input: skip packages below n"
+               " daily downloads\n"
+               "  --reverse                CSV input: point edges from"
+               " dependency to dependent\n"
+               "  --edge-prob <model>      CSV input: edge probability, a"
+               " constant (default 0.1)\n"
+               "                           or logistic[:bias=..,inactivity=..,"
+               "maintainers=..,\n"
+               "                           downloads=..]\n"
+               "  --min-edge-prob <p>      drop edges whose probability is"
+               " below p\n"
+               "  --reorder <bfs|rcm|degree>\n"
+               "                           renumber the nodes for memory"
+               " locality after loading\n"
+               "  --engine <celf|imm|skim|mia>\n"
+               "                           seed selection engine (default"
+               " celf)\n"
+               "  --max-depth <d>          celf/mia: cut every cascade d hops"
+               " from its seeds\n"
+               "  --min-path-prob <t>      mia: drop paths less likely than t"
+               " (default 1/320)\n"
+               "  --checkpoint <file>      celf: save the queue and seeds"
+               " after every seed\n"
+               "  --resume <file>          celf: continue the run saved in"
+               " file (and keep saving\n"
+               "                           there unless --checkpoint is"
+               " given)\n"
+               "  --extend-k <k>           with --resume: go on up to k seeds"
+               " instead of the saved k\n"
+               "  --gpu                    celf: run the initial spreads as"
+               " OpenMP target regions\n"
+               "  --adaptive <tol>         celf: stop sampling an estimate once"
+               " its 99% interval\n"
+               "                           is within tol of its mean, or below"
+               " the best gain\n"
+               "  --epsilon <e>            imm: approximation slack (default"
+               " 0.1)\n"
+               "  --delta <d>              imm: failure probability (default"
+               " 1/n)\n"
+               "  --rr-index <file>        imm: reuse the RR sets stored in"
+               " file, refreshed for\n"
+               "                           changed weights and edges, and"
+               " store them back\n"
+               "  --stream <file>          write each seed as a JSON line"
+               " (CSV row for .csv) as\n"
+               "                           soon as it is selected, plus"
+               " progress events\n"
+               "  --profile-json <file>    also write the profile summary as"
+               " JSON\n"
+               "  --sketch-k <n>           skim/--query: bottom-k sketch size"
+               " (default 64)\n"
+               "  --query <pkg[,pkg...]>   print the sketch-estimated reach"
+               " and marginal gain of\n"
+               "                           each package in turn instead of"
+               " selecting seeds\n"
+               "  --serve <socket>         keep the graph and sketches loaded"
+               " and answer spread,\n"
+               "                           gain and top-k queries on a Unix"
+               " socket\n"
+               "  --seed <n>               seed for every random stream;"
+               " a run with the same seed\n"
+               "                           and inputs selects the same seeds"
+               " on any thread count"
+            << std::endl;
+}
+
+static bool parse_options(int argc, char *argv[], Options &opt) {
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      positional.push_back(arg);
+      continue;
+    }
+    if (arg == "--reverse") {
+      opt.reverse = true;
+      continue;
+    }
+    if (arg == "--gpu") {
+      opt.gpu = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+    std::string value = argv[++i];
+    if (arg == "--write-snapshot") {
+      opt.write_snapshot = value;
+    } else if (arg == "--edges") {
+      opt.edges_csv = value;
+    } else if (arg == "--min_avg_daily") {
+      opt.min_avg_daily = std::stoll(value);
+    } else if (arg == "--edge-prob") {
+      opt.edge_model = value;
+    } else if (arg == "--min-edge-prob") {
+      opt.min_edge_prob = std::stod(value);
+    } else if (arg == "--max-depth") {
+      opt.max_depth = std::stoi(value);
+    } else if (arg == "--checkpoint") {
+      opt.checkpoint = value;
+    } else if (arg == "--resume") {
+      opt.resume = value;
+    } else if (arg == "--extend-k") {
+      opt.extend_k = std::stoi(value);
+    } else if (arg == "--reorder") {
+      opt.reorder = value;
+    } else if (arg == "--adaptive") {
+      opt.adaptive = std::stod(value);
+    } else if (arg == "--min-path-prob") {
+      opt.min_path_prob = std::stod(value);
+    } else if (arg == "--engine") {
+      opt.engine = value;
+    } else if (arg == "--epsilon") {
+      opt.epsilon = std::stod(value);
+    } else if (arg == "--delta") {
+      opt.delta = std::stod(value);
+    } else if (arg == "--seed") {
+      opt.seed = std::stoull(value);
+      opt.has_seed = true;
+    } else if (arg == "--profile-json") {
+      opt.profile_json = value;
+    } else if (arg == "--stream") {
+      opt.stream = value;
+    } else if (arg == "--rr-index") {
+      opt.rr_index = value;
+    } else if (arg == "--serve") {
+      opt.serve = value;
+    } else if (arg == "--sketch-k") {
+      opt.sketch_k = std::stoi(value);
+    } else if (arg == "--query") {
+      size_t begin = 0;
+      while (begin <= value.size()) {
+        size_t end = std::min(value.find(',', begin), value.size());
+        if (end > begin)
+          opt.query.push_back(value.substr(begin, end - begin));
+        begin = end + 1;
+      }
+    } else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  if (positional.size() < 3 || positional.size() > 4)
+    return false;
+  opt.input = positional[0];
+  opt.k = std::stoi(positional[1]);
+  const std::string &spec = positional[2];
+  for (size_t begin = 0; begin <= spec.size();) {
+    size_t end = std::min(spec.find(',', begin), spec.size());
+    std::string item = spec.substr(begin, end - begin);
+    begin = end + 1;
+    if (item.empty())
+      continue;
+    size_t colon = item.rfind(':');
+    Job job{item, opt.k};
+    if (colon != std::string::npos) {
+      job.attribute = item.substr(0, colon);
+      job.k = std::stoi(item.substr(colon + 1));
+    }
+    for (const auto &other : opt.jobs)
+      if (other.attribute == job.attribute) {
+        std::cerr << "Attribute " << job.attribute << " given twice"
+                  << std::endl;
+        return false;
+      }
+    opt.jobs.push_back(job);
+  }
+  if (opt.jobs.empty())
+    return false;
+  if (positional.size() == 4)
+    opt.mc_rounds = std::stoi(positional[3]);
+  if (opt.engine != "celf" && opt.engine != "imm" && opt.engine != "skim" &&
+      opt.engine != "mia") {
+    std::cerr << "Unknown engine " << opt.engine << std::endl;
+    return false;
+  }
+  if ((!opt.checkpoint.empty() || !opt.resume.empty()) &&
+      (opt.engine != "celf" || !opt.query.empty() || !opt.serve.empty())) {
+    std::cerr << "--checkpoint and --resume need --engine celf" << std::endl;
+    return false;
+  }
+  if (opt.extend_k != 0 && (opt.resume.empty() || opt.extend_k < 1)) {
+    std::cerr << "--extend-k needs --resume and k >= 1" << std::endl;
+    return false;
+  }
+  if (!opt.reorder.empty() && opt.reorder != "bfs" && opt.reorder != "rcm" &&
+      opt.reorder != "degree") {
+    std::cerr << "Unknown node order " << opt.reorder << std::endl;
+    return false;
+  }
+  if (opt.adaptive < 0.0 || (opt.adaptive > 0.0 && opt.engine != "celf")) {
+    std::cerr << "--adaptive needs --engine celf and a tolerance >= 0"
+              << std::endl;
+    return false;
+  }
+  // the device runs every world of every candidate
+  if (opt.gpu && (opt.engine != "celf" || opt.adaptive > 0.0)) {
+    std::cerr << "--gpu needs --engine celf without --adaptive" << std::endl;
+    return false;
+  }
+  if (opt.max_depth < 0 ||
+      (opt.max_depth > 0 && opt.engine != "celf" && opt.engine != "mia")) {
+    std::cerr << "--max-depth needs --engine celf or mia" << std::endl;
+    return false;
+  }
+  if (!opt.rr_index.empty() && opt.engine != "imm") {
+    std::cerr << "--rr-index needs --engine imm" << std::endl;
+    return false;
+  }
+  if (!opt.rr_index.empty() && opt.jobs.size() > 1) {
+    std::cerr << "--rr-index holds the RR sets of a single attribute"
+              << std::endl;
+    return false;
+  }
+  if (!opt.serve.empty() && (opt.jobs.size() > 1 || !opt.query.empty())) {
+    std::cerr << "--serve answers queries on a single attribute" << std::endl;
+    return false;
+  }
+  if (opt.sketch_k < 2) {
+    std::cerr << "--sketch-k must be at least 2" << std::endl;
+    return false;
+  }
+  if (ends_with(opt.input, ".csv") && opt.edges_csv.empty()) {
+    std::cerr << "A nodes CSV input needs --edges" << std::endl;
+    return false;
+  }
+  EdgeModel model;
+  if (!opt.edge_model.empty() && !ends_with(opt.input, ".csv")) {
+    std::cerr << "--edge-prob needs a nodes CSV input" << std::endl;
+    return false;
+  }
+  if (!opt.edge_model.empty() && !EdgeModel::parse(opt.edge_model, model)) {
+    std::cerr << "Bad edge model " << opt.edge_model << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// seeds.jsonl -> seeds.<attribute>.jsonl, so batch jobs stream apart
+static std::string job_path(const std::string &path,
+                            const std::string &attribute) {
+  size_t dot = path.rfind('.');
+  size_t slash = path.rfind('/');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash))
+    return path + "." + attribute;
+  return path.substr(0, dot) + "." + attribute + path.substr(dot);
+}
+
+// MPI_Init/MPI_Finalize around main; only rank 0 prints
+struct ClusterSession {
+  ClusterSession(int &argc, char **&argv) {
+    Cluster::get().init(argc, argv);
+    if (!Cluster::get().root()) {
+      std::cout.rdbuf(nullptr);
+      std::cerr.rdbuf(nullptr);
+    }
+  }
+  ~ClusterSession() { Cluster::get().finalize(); }
+};
+
+int main(int argc, char *argv[]) {
+  ClusterSession session(argc, argv);
+  Cluster &cluster = Cluster::get();
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (cluster.size() > 1 && (!opt.rr_index.empty() || !opt.serve.empty())) {
+    std::cerr << "--rr-index and --serve need a single process" << std::endl;
+    return 1;
+  }
+
+  int mc_rounds = opt.mc_rounds;
+  std::vector<std::string> attributes;
+  for (const auto &job : opt.jobs)
+    attributes.push_back(job.attribute);
+
+  try {
+    Graph g;
+    ScopedPhase load("load");
+    if (!cluster.root()) {
+      // filled from rank 0 below
+    } else if (ends_with(opt.input, ".wmig")) {
+      std::cout << "Loading snapshot..." << std::endl;
+      g = GraphSnapshot::read(opt.input, attributes);
+    } else if (ends_with(opt.input, ".csv")) {
+      std::cout << "Reading CSV..." << std::endl;
+      EdgeModel model;
+      EdgeModel::parse(opt.edge_model.empty() ? "0.1" : opt.edge_model,
+                       model);
+      g = CSVLoader::load(opt.input, opt.edges_csv, attributes,
+                          opt.min_avg_daily, opt.reverse, model);
+    } else {
+      std::cout << "Parsing GEXF..." << std::endl;
+      g = GEXFParser::parse(opt.input, attributes);
+    }
+
+    if (opt.min_edge_prob > 0.0 && cluster.root()) {
+      size_t dropped = g.drop_weak_edges(opt.min_edge_prob);
+      std::cerr << "Dropped " << dropped << " edges below probability "
+                << opt.min_edge_prob << ", " << g.num_edges() << " remain"
+                << std::endl;
+    }
+    if (!opt.reorder.empty() && cluster.root()) {
+      ScopedPhase phase("reorder");
+      double before = mean_edge_span(g);
+      g.permute(locality_order(g, opt.reorder));
+      std::cerr << "Reordered " << g.num_nodes() << " nodes by "
+                << opt.reorder << ": mean edge span " << before << " -> "
+                << mean_edge_span(g) << std::endl;
+    }
+    // rank 0 loaded the graph; the others get it as an in-memory snapshot
+    if (cluster.size() > 1) {
+      std::string bytes;
+      if (cluster.root()) {
+        std::ostringstream buffer;
+        GraphSnapshot::write(g, buffer);
+        bytes = buffer.str();
+      }
+      cluster.broadcast(bytes);
+      if (!cluster.root())
+        g = GraphSnapshot::read(bytes.data(), bytes.size(), "broadcast",
+                                attributes);
+      std::cerr << "Broadcast " << bytes.size() / (1024.0 * 1024.0)
+                << " MB graph to " << cluster.size() << " ranks" << std::endl;
+    }
+    load.stop();
+
+    if (!opt.write_snapshot.empty() && cluster.root()) {
+      ScopedPhase write("write snapshot");
+      GraphSnapshot::write(g, opt.write_snapshot);
+    }
+
+    std::cout << "Nodes: " << g.num_nodes() << std::endl;
+    uint64_t seed = opt.has_seed ? opt.seed : entropy_seed();
+    // a resumed run goes on with the worlds it was started with
+    if (!opt.has_seed && !opt.resume.empty())
+      seed = CelfCheckpoint::load(opt.jobs.size() > 1
+                                      ? job_path(opt.resume,
+                                                 opt.jobs[0].attribute)
+                                      : opt.resume)
+                 .seed;
+    cluster.broadcast(seed);
+    std::cout << "Seed: " << seed << std::endl;
+
+    // MIA trees only depend on the graph: build them once for the roots
+    // of every job
+    Arborescences trees;
+    if (opt.engine == "mia" && opt.query.empty() && opt.serve.empty() &&
+        cluster.root()) {
+      ScopedPhase build("MIA arborescences");
+      std::vector<char> is_root(g.num_nodes(), 0);
+      for (const auto &column : g.value_columns)
+        for (size_t v = 0; v < column.size(); ++v)
+          is_root[v] |= column[v] != 0.0;
+      trees = build_arborescences(g, opt.min_path_prob, opt.max_depth,
+                                  is_root);
+    }
+
+    // every job uses the same seed, so the engines sample the same
+    // live-edge worlds for each attribute
+    for (size_t j = 0; j < opt.jobs.size(); ++j) {
+      const Job &job = opt.jobs[j];
+      int k = job.k;
+      g.use_values(j);
+      if (opt.jobs.size() > 1)
+        std::cout << "=== " << job.attribute << " (k=" << k << ") ==="
+                  << std::endl;
+      std::cout << "Eligible seeds (has attribute): ";
+      int eligible = 0;
+      for (int i = 0; i < g.num_nodes(); ++i)
+        if (g.has_value[i])
+          eligible++;
+      std::cout << eligible << std::endl;
+
+      // only celf and imm are distributed; other ranks sit the rest out
+      bool distributed = opt.query.empty() && opt.serve.empty() &&
+                         (opt.engine == "celf" || opt.engine == "imm");
+      if (!distributed && !cluster.root())
+        continue;
+      if (!opt.query.empty()) {
+        answer_sketch_queries(g, opt.query, mc_rounds, opt.sketch_k, seed);
+        continue;
+      }
+      if (!opt.serve.empty()) {
+        serve_sketch_queries(g, opt.serve, mc_rounds, opt.sketch_k, seed);
+        continue;
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      std::string stream = opt.stream;
+      if (!stream.empty() && opt.jobs.size() > 1)
+        stream = job_path(stream, job.attribute);
+      SeedReporter out(g, cluster.root() ? stream : "");
+      std::vector<int> seeds;
+      if (opt.engine == "imm") {
+        double delta =
+            opt.delta > 0.0 ? opt.delta : 1.0 / std::max(g.num_nodes(), 2);
+        std::cout << "Running Weighted IMM with k=" << k << "..."
+                  << std::endl;
+        seeds = imm_weighted_influence(g, k, opt.epsilon, delta, seed, out,
+                                       opt.rr_index);
+      } else if (opt.engine == "skim") {
+        std::cout << "Running Weighted SKIM with k=" << k << "..."
+                  << std::endl;
+        seeds =
+            skim_weighted_influence(g, k, mc_rounds, opt.sketch_k, seed, out);
+      } else if (opt.engine == "mia") {
+        std::cout << "Running Weighted MIA with k=" << k << "..."
+                  << std::endl;
+        seeds = mia_weighted_influence(g, k, trees, out);
+      } else {
+        std::string checkpoint =
+            opt.checkpoint.empty() ? opt.resume : opt.checkpoint;
+        std::string resume = opt.resume;
+        if (opt.jobs.size() > 1 && !checkpoint.empty())
+          checkpoint = job_path(checkpoint, job.attribute);
+        if (opt.jobs.size() > 1 && !resume.empty())
+          resume = job_path(resume, job.attribute);
+        CelfCheckpoint state;
+        if (!resume.empty()) {
+          state = CelfCheckpoint::load(resume);
+          k = opt.extend_k > 0 ? opt.extend_k : state.k;
+        }
+        std::cout << "Running Weighted CELF with mc_rounds=" << mc_rounds
+                  << "..." << std::endl;
+        seeds = celf_weighted_influence(g, k, mc_rounds, seed, out,
+                                        opt.max_depth, opt.gpu, opt.adaptive,
+                                        checkpoint,
+                                        resume.empty() ? nullptr : &state);
+      }
+      auto end = std::chrono::high_resolution_clock::now();
+
+      std::cout << "---------------------------------" << std::endl;
+      std::cout << "Selected Seeds: ";
+      for (int s : seeds)
+        std::cout << g.name(s) << " ";
+      std::cout << std::endl;
+
+      std::chrono::duration<double> elapsed = end - start;
+      std::cout << "Time: " << elapsed.count() << "s" << std::endl;
+    }
 
-    std::chrono::duration<double> elapsed = end - start;
-    std::cout << "Time: " << elapsed.count() << "s" << std::endl;
+    Profiler::get().report(std::cerr);
+    if (!opt.profile_json.empty())
+      Profiler::get().write_json(opt.profile_json);
 
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << std::endl;
+    cluster.abort(1);
     return 1;
   }
 
   return 0;
 }
+#endif